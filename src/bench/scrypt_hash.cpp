@@ -0,0 +1,45 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "crypto/scrypt.h"
+
+#include <string.h>
+#include <vector>
+
+/* Number of nonces hashed per iteration */
+static const uint32_t NONCES_PER_ITERATION = 32;
+
+static void ScryptStack(benchmark::State& state)
+{
+    std::vector<char> header(80, 0);
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    char hash[32];
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < NONCES_PER_ITERATION; i++) {
+            memcpy(&header[76], &nonce, 4);
+            ++nonce;
+            scrypt_1024_1_1_256_sp(header.data(), hash, scratchpad);
+        }
+    }
+}
+
+static void ScryptContextNonce(benchmark::State& state)
+{
+    std::vector<char> header(80, 0);
+    ScryptContext context;
+    char hash[32];
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < NONCES_PER_ITERATION; i++) {
+            memcpy(&header[76], &nonce, 4);
+            ++nonce;
+            context.Hash(header.data(), hash);
+        }
+    }
+}
+
+BENCHMARK(ScryptStack);
+BENCHMARK(ScryptContextNonce);
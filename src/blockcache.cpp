@@ -0,0 +1,67 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "core_memusage.h"
+
+/** Memory attributed to one cached block, including the cache's own bookkeeping. */
+static size_t CachedBlockUsage(const std::shared_ptr<const CBlock>& pblock)
+{
+    return RecursiveDynamicUsage(pblock) + 4 * sizeof(void*) + sizeof(uint256);
+}
+
+void CBlockCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listBlocks.empty()) {
+        nUsage -= CachedBlockUsage(listBlocks.back().second);
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+    }
+}
+
+void CBlockCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+std::shared_ptr<const CBlock> CBlockCache::Get(const uint256& hash)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    auto it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return nullptr;
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    return it->second->second;
+}
+
+void CBlockCache::Insert(const uint256& hash, const std::shared_ptr<const CBlock>& pblock)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (nMaxUsage == 0)
+        return;
+    auto it = mapBlocks.find(hash);
+    if (it != mapBlocks.end()) {
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+        return;
+    }
+    listBlocks.emplace_front(hash, pblock);
+    mapBlocks.emplace(hash, listBlocks.begin());
+    nUsage += CachedBlockUsage(pblock);
+    Trim();
+}
+
+size_t CBlockCache::Size()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return listBlocks.size();
+}
+
+size_t CBlockCache::Usage()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return nUsage;
+}
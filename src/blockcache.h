@@ -0,0 +1,58 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef herbsters_BLOCKCACHE_H
+#define herbsters_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/** -blockcachesize default, in megabytes */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+/**
+ * Recently connected, read or served blocks, by hash, so that a block that
+ * many peers and clients ask for right after it arrives is only read from
+ * disk and checked once. Blocks are evicted least recently used first
+ * when their memory usage exceeds the configured size.
+ */
+class CBlockCache
+{
+private:
+    struct CacheHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+    typedef std::list<std::pair<uint256, std::shared_ptr<const CBlock>>> BlockList;
+
+    std::mutex cs;
+    size_t nMaxUsage;
+    size_t nUsage;
+    BlockList listBlocks; //!< most recently used first
+    std::unordered_map<uint256, BlockList::iterator, CacheHasher> mapBlocks;
+
+    void Trim();
+
+public:
+    explicit CBlockCache(size_t nMaxUsageIn = 0) : nMaxUsage(nMaxUsageIn), nUsage(0) {}
+
+    /** Set the maximum memory usage of the cached blocks; 0 disables the cache. */
+    void SetMaxUsage(size_t nMaxUsageIn);
+
+    /** Get the block with the given hash, or null if it is not cached. */
+    std::shared_ptr<const CBlock> Get(const uint256& hash);
+
+    /** Add a block, which must have the given hash. */
+    void Insert(const uint256& hash, const std::shared_ptr<const CBlock>& pblock);
+
+    size_t Size();
+    size_t Usage();
+};
+
+#endif // herbsters_BLOCKCACHE_H
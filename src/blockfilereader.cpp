@@ -0,0 +1,99 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+
+#include <limits>
+#include <stdint.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileMapping::~CBlockFileMapping()
+{
+#ifndef WIN32
+    munmap(const_cast<unsigned char*>(pdata), nSize);
+#endif
+}
+
+/** Map the whole file at path, if it holds at least nMinSize bytes. */
+static std::shared_ptr<const CBlockFileMapping> MapFile(const fs::path& path, size_t nMinSize)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    void* pdata = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size >= nMinSize && (uint64_t)st.st_size <= std::numeric_limits<size_t>::max()) {
+        pdata = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pdata == MAP_FAILED)
+        return nullptr;
+    return std::make_shared<const CBlockFileMapping>((const unsigned char*)pdata, (size_t)st.st_size);
+#endif
+}
+
+void CBlockFileReader::SetMaxMappings(size_t nMaxMappingsIn)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    nMaxMappings = nMaxMappingsIn;
+    while (listMappings.size() > nMaxMappings) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+}
+
+std::shared_ptr<const CBlockFileMapping> CBlockFileReader::Map(const fs::path& path, size_t nMinSize)
+{
+    const std::string strPath = path.string();
+    std::lock_guard<std::mutex> lock(cs);
+    if (nMaxMappings == 0)
+        return nullptr;
+
+    std::map<std::string, MappingList::iterator>::iterator it = mapMappings.find(strPath);
+    if (it != mapMappings.end()) {
+        listMappings.splice(listMappings.begin(), listMappings, it->second);
+        if (it->second->second->size() >= nMinSize)
+            return it->second->second;
+        // The file has grown since it was mapped.
+        listMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+
+    std::shared_ptr<const CBlockFileMapping> mapping = MapFile(path, nMinSize);
+    if (!mapping)
+        return nullptr;
+    listMappings.emplace_front(strPath, mapping);
+    mapMappings[strPath] = listMappings.begin();
+    if (listMappings.size() > nMaxMappings) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+    return mapping;
+}
+
+void CBlockFileReader::Invalidate(const fs::path& path)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    std::map<std::string, MappingList::iterator>::iterator it = mapMappings.find(path.string());
+    if (it != mapMappings.end()) {
+        listMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+}
+
+void CBlockFileReader::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    mapMappings.clear();
+    listMappings.clear();
+}
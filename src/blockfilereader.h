@@ -0,0 +1,79 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef herbsters_BLOCKFILEREADER_H
+#define herbsters_BLOCKFILEREADER_H
+
+#include "fs.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/** -blockfilemappings default: the number of block and undo files kept mapped */
+static const unsigned int DEFAULT_BLOCKFILE_MAPPINGS = 32;
+
+/** A read-only memory mapping of a whole file, unmapped when the last reference goes away. */
+class CBlockFileMapping
+{
+private:
+    const unsigned char* pdata;
+    size_t nSize;
+
+public:
+    CBlockFileMapping(const unsigned char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CBlockFileMapping();
+
+    CBlockFileMapping(const CBlockFileMapping&) = delete;
+    CBlockFileMapping& operator=(const CBlockFileMapping&) = delete;
+
+    const unsigned char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Memory mappings of block (blk?????.dat) and undo (rev?????.dat) files, so
+ * records can be deserialized from the page cache without a file open, seek
+ * and copy per read. The most recently used mappings are kept, up to a
+ * configured number; a mapping stays valid while a reader holds it, even
+ * after it is evicted.
+ *
+ * Files only grow while blocks are appended, and a file that is now longer
+ * than its mapping is mapped again on demand. Files that are truncated or
+ * deleted have to be invalidated. Readers must only access records that
+ * are known to lie within the file.
+ */
+class CBlockFileReader
+{
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<const CBlockFileMapping>>> MappingList;
+
+    std::mutex cs;
+    size_t nMaxMappings;
+    MappingList listMappings; //!< most recently used first
+    std::map<std::string, MappingList::iterator> mapMappings;
+
+public:
+    explicit CBlockFileReader(size_t nMaxMappingsIn = 0) : nMaxMappings(nMaxMappingsIn) {}
+
+    /** Set the number of mappings kept; 0 disables mapping. */
+    void SetMaxMappings(size_t nMaxMappingsIn);
+
+    /**
+     * Get a mapping of the file at path that covers at least its first
+     * nMinSize bytes. Returns null if mapping is disabled or not supported,
+     * or if the file cannot be mapped or is shorter than that.
+     */
+    std::shared_ptr<const CBlockFileMapping> Map(const fs::path& path, size_t nMinSize);
+
+    /** Drop the mapping of a file that is about to shrink or be removed. */
+    void Invalidate(const fs::path& path);
+
+    /** Drop all mappings. */
+    void Clear();
+};
+
+#endif // herbsters_BLOCKFILEREADER_H
@@ -160,6 +160,14 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    //! Header's scrypt proof of work was checked when this entry was created. Reads of the block data only need
+    //! to match the (SHA256d) block hash against the index to inherit that check.
+    BLOCK_POW_VERIFIED      =   256,
+
+    //! Block was not downloaded: its validity and the coins it created were taken from a UTXO snapshot
+    //! (-loadtxoutset). Like a pruned block it has nTx set but no data.
+    BLOCK_ASSUMED_VALID     =   512,
 };
 
 /** The block chain is a tree shaped structure starting with the
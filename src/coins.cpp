@@ -7,13 +7,27 @@
 #include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <assert.h>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+size_t CCoinsView::GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const
+{
+    size_t nFound = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (GetCoin(outpoints[i], coins[i]) && !coins[i].IsSpent())
+            nFound++;
+        else
+            coins[i].Clear();
+    }
+    return nFound;
+}
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) { return false; }
+bool CCoinsView::GetUTXOSetHash(MuHash3072 &hash) const { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -24,17 +38,20 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+size_t CCoinsViewBacked::GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const { return base->GetCoins(outpoints, coins, count); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) { return base->BatchWrite(mapCoins, hashBlock, hashUTXODelta); }
+bool CCoinsViewBacked::GetUTXOSetHash(MuHash3072 &hash) const { return base->GetUTXOSetHash(hash); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -81,7 +98,16 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
             throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
+    } else if (!inserted) {
+        if (!it->second.coin.IsSpent())
+            RemoveCoinHash(hashUTXODelta, outpoint, it->second.coin);
+    } else {
+        // The coin being overwritten, if any, is only known to the base.
+        Coin overwritten;
+        if (base->GetCoin(outpoint, overwritten) && !overwritten.IsSpent())
+            RemoveCoinHash(hashUTXODelta, outpoint, overwritten);
     }
+    ApplyCoinHash(hashUTXODelta, outpoint, coin);
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -101,6 +127,8 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool
 bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return false;
+    if (!it->second.coin.IsSpent())
+        RemoveCoinHash(hashUTXODelta, outpoint, it->second.coin);
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     if (moveout) {
         *moveout = std::move(it->second.coin);
@@ -125,6 +153,46 @@ const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
     }
 }
 
+size_t CCoinsViewCache::GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const {
+    // Answer from the cache where possible, and fetch the rest from the base
+    // in one call, caching what it finds like FetchCoin does.
+    size_t nFound = 0;
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < count; i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it == cacheCoins.end()) {
+            vMissing.push_back(outpoints[i]);
+            vMissingPos.push_back(i);
+        } else if (it->second.coin.IsSpent()) {
+            coins[i].Clear();
+        } else {
+            coins[i] = it->second.coin;
+            nFound++;
+        }
+    }
+    if (vMissing.empty())
+        return nFound;
+
+    std::vector<Coin> vFetched(vMissing.size());
+    base->GetCoins(vMissing.data(), vFetched.data(), vMissing.size());
+    for (size_t j = 0; j < vMissing.size(); j++) {
+        Coin& coin = coins[vMissingPos[j]];
+        if (vFetched[j].IsSpent()) {
+            coin.Clear();
+            continue;
+        }
+        coin = vFetched[j];
+        nFound++;
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(vMissing[j]), std::forward_as_tuple(std::move(vFetched[j])));
+        if (inserted)
+            cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+    return nFound;
+}
+
 bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
@@ -135,6 +203,16 @@ bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
+void CCoinsViewCache::CacheFetchedCoin(const COutPoint &outpoint, Coin&& coin) {
+    if (coin.IsSpent()) return;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    }
+}
+
 uint256 CCoinsViewCache::GetBestBlock() const {
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
@@ -145,7 +223,14 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::GetUTXOSetHash(MuHash3072 &hash) const {
+    if (!base->GetUTXOSetHash(hash))
+        return false;
+    hash *= hashUTXODelta;
+    return true;
+}
+
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const MuHash3072 &hashUTXODeltaIn) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
@@ -198,16 +283,83 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         mapCoins.erase(itOld);
     }
     hashBlock = hashBlockIn;
+    hashUTXODelta *= hashUTXODeltaIn;
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashUTXODelta);
+    hashUTXODelta = MuHash3072();
     cacheCoins.clear();
+    ReallocateCache();
+    cachedCoinsUsage = 0;
+    return fOk;
+}
+
+bool CCoinsViewCache::PartialFlush(size_t nRetainUsage) {
+    // Find the lowest creation height to keep: add up the memory used by the
+    // coins of each height, starting from the most recent, until the budget
+    // is spent. The node size is an estimate; the map is rebuilt below, so
+    // the accounting is exact again afterwards.
+    static const size_t nEntryOverhead = sizeof(CCoinsMap::value_type) + 2 * sizeof(void*);
+    std::vector<size_t> vUsageByHeight;
+    for (const CCoinsMap::value_type& entry : cacheCoins) {
+        if (entry.second.coin.IsSpent())
+            continue;
+        const uint32_t nHeight = entry.second.coin.nHeight;
+        if (nHeight >= vUsageByHeight.size())
+            vUsageByHeight.resize(nHeight + 1);
+        vUsageByHeight[nHeight] += nEntryOverhead + entry.second.coin.DynamicMemoryUsage();
+    }
+    size_t nKeepHeight = vUsageByHeight.size();
+    size_t nKeepUsage = 0;
+    while (nKeepHeight > 0 && nKeepUsage + vUsageByHeight[nKeepHeight - 1] <= nRetainUsage) {
+        nKeepUsage += vUsageByHeight[--nKeepHeight];
+    }
+
+    // The base takes over the entries it is given. Modified entries that are
+    // evicted are moved there; only the modified ones that stay cached are
+    // copied. Spent entries are erased in the base and are not kept, and
+    // neither are coins older than nKeepHeight.
+    CCoinsMapMemoryResource writeResource;
+    CCoinsMap mapWrite(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &writeResource);
+    std::vector<std::pair<COutPoint, Coin>> vKeep;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it = cacheCoins.erase(it)) {
+        const bool fDirty = it->second.flags & CCoinsCacheEntry::DIRTY;
+        if (!it->second.coin.IsSpent() && it->second.coin.nHeight >= nKeepHeight) {
+            if (fDirty)
+                mapWrite.emplace(it->first, it->second);
+            vKeep.emplace_back(it->first, std::move(it->second.coin));
+        } else if (fDirty) {
+            mapWrite.emplace(it->first, std::move(it->second));
+        }
+    }
+    // Rebuilding the map returns the memory of evicted entries before the
+    // base gets to them.
+    ReallocateCache();
     cachedCoinsUsage = 0;
+    bool fOk = base->BatchWrite(mapWrite, hashBlock, hashUTXODelta);
+    hashUTXODelta = MuHash3072();
+
+    // Everything that remains matches the base now.
+    cacheCoins.reserve(vKeep.size());
+    for (std::pair<COutPoint, Coin>& entry : vKeep) {
+        CCoinsCacheEntry& cached = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(entry.first), std::forward_as_tuple(std::move(entry.second))).first->second;
+        cachedCoinsUsage += cached.coin.DynamicMemoryUsage();
+    }
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache()
+{
+    // Clearing the map only returns its nodes to the pool's free lists.
+    assert(cacheCoins.size() == 0);
+    cacheCoins.~CCoinsMap();
+    m_cache_coins_memory_resource.~CCoinsMapMemoryResource();
+    ::new (&m_cache_coins_memory_resource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &m_cache_coins_memory_resource);
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -258,3 +410,24 @@ const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
     }
     return coinEmpty;
 }
+
+static void SerializeCoinForHash(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
+{
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+}
+
+void ApplyCoinHash(MuHash3072& hash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoinForHash(ss, outpoint, coin);
+    hash.Insert((const unsigned char*)ss.data(), ss.size());
+}
+
+void RemoveCoinHash(MuHash3072& hash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoinForHash(ss, outpoint, coin);
+    hash.Remove((const unsigned char*)ss.data(), ss.size());
+}
@@ -9,9 +9,11 @@
 #include "primitives/transaction.h"
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -119,7 +121,16 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The coins cache is a hash map whose nodes all come from a PoolResource
+ * owned by the cache, instead of one malloc per coin. The pool's size class
+ * covers the entry plus the node bookkeeping of the hash map (next pointer
+ * and cached hash code).
+ */
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>,
+                           PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                                         sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>> CCoinsMap;
+typedef CCoinsMap::allocator_type::ResourceType CCoinsMapMemoryResource;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -151,6 +162,13 @@ public:
      */
     virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
+    /** Retrieve the Coins for count outpoints at once, which views backed by
+     *  a database can do faster than one GetCoin per outpoint. Outpoints
+     *  without an unspent coin leave their entry in coins spent.
+     *  Returns the number of unspent coins found.
+     */
+    virtual size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const;
+
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
@@ -164,8 +182,13 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. hashUTXODelta holds the coins
+    //! the modifications add and remove, for the rolling UTXO set hash.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta);
+
+    //! Retrieve the rolling hash of the unspent outputs in this view (see
+    //! ApplyCoinHash). Returns false if the view does not maintain one.
+    virtual bool GetUTXOSetHash(MuHash3072 &hash) const;
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -187,11 +210,13 @@ protected:
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) override;
+    bool GetUTXOSetHash(MuHash3072 &hash) const override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -206,20 +231,27 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Backing memory of cacheCoins; must be declared before it. */
+    mutable CCoinsMapMemoryResource m_cache_coins_memory_resource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Coins added and removed since the last flush, as a rolling hash delta. */
+    MuHash3072 hashUTXODelta;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) override;
+    bool GetUTXOSetHash(MuHash3072 &hash) const override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -231,6 +263,14 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Add a coin that was read from the base view as an unmodified cache
+     * entry, as a cache miss in AccessCoin would. Nothing happens if the
+     * outpoint is cached already (the cache is newer than the base) or if
+     * the coin is spent.
+     */
+    void CacheFetchedCoin(const COutPoint &outpoint, Coin&& coin);
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
@@ -263,6 +303,16 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the unspent coins that were created most recently cached as
+     * unmodified entries, up to about nRetainUsage bytes of
+     * DynamicMemoryUsage(). Older coins are evicted first, as recently
+     * created outputs are the ones most likely to be spent soon.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool PartialFlush(size_t nRetainUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -291,6 +341,12 @@ public:
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 
+    /**
+     * Recreate the (empty) cacheCoins and its memory resource, returning the
+     * pool chunks to the system.
+     */
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -311,4 +367,11 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool
 // lookups to database, so it should be used with care.
 const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
 
+//! Add an unspent output to a rolling UTXO set hash. The hash commits to the
+//! outpoint, the creation height, the coinbase flag and the output.
+void ApplyCoinHash(MuHash3072& hash, const COutPoint& outpoint, const Coin& coin);
+
+//! Remove an unspent output from a rolling UTXO set hash.
+void RemoveCoinHash(MuHash3072& hash, const COutPoint& outpoint, const Coin& coin);
+
 #endif // herbsters_COINS_H
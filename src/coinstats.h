@@ -0,0 +1,42 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef herbsters_COINSTATS_H
+#define herbsters_COINSTATS_H
+
+#include "amount.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+
+class CCoinsView;
+class CHashWriter;
+class Coin;
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * Add the unspent outputs of one transaction to the statistics and to the
+ * serialized hash. Transactions have to be applied in txid order, after the
+ * best block hash has been written to ss.
+ */
+void ApplyStats(CCoinsStats& stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs);
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
+
+#endif // herbsters_COINSTATS_H
@@ -47,6 +47,14 @@
 #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+// Wait on sockets with epoll (the P2P socket handler) and poll() (netbase)
+// instead of select(), so sockets are not limited to FD_SETSIZE.
+#define USE_EPOLL
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #ifndef WIN32
 typedef unsigned int SOCKET;
 #include "errno.h"
@@ -77,7 +85,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -0,0 +1,108 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef herbsters_CRYPTO_MUHASH_H
+#define herbsters_CRYPTO_MUHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    limb_t limbs[LIMBS];
+
+    static_assert(LIMB_SIZE * LIMBS == 3072, "Num3072 has to be 3072 bits");
+    static_assert(sizeof(double_limb_t) == sizeof(limb_t) * 2, "bad size for double_limb_t");
+    static_assert(sizeof(limb_t) * 8 == LIMB_SIZE, "LIMB_SIZE is incorrect");
+
+    /** Initialize to one. */
+    Num3072() { SetToOne(); }
+    /** Load a little endian number of BYTE_SIZE bytes. */
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Square() { Multiply(*this); }
+    void Divide(const Num3072& a);
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    Num3072 GetInverse() const;
+};
+
+/**
+ * A hash of a set of byte strings that can be updated in constant time when
+ * an element is added or removed ("MuHash", see
+ * https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf).
+ *
+ * Every element is hashed to a number modulo a 3072-bit prime, and the set
+ * hash is the product of those numbers. Adding an element multiplies by its
+ * number and removing it divides by it, so the result does not depend on the
+ * order of the updates. Divisions are deferred by keeping a separate
+ * denominator, which is only inverted once in Finalize().
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    /** The hash of the empty set. */
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    /** Add all the elements of another set (which must not overlap with this one). */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    /** Remove all the elements of another set (which must be a subset of this one). */
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** Compute the 32-byte digest of the set. */
+    void Finalize(unsigned char (&out)[32]);
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        Num3072 num = m_numerator;
+        num.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        num = m_denominator;
+        num.ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        m_numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        m_denominator = Num3072(data);
+    }
+};
+
+#endif // herbsters_CRYPTO_MUHASH_H
@@ -28,10 +28,12 @@
  */
 
 #include "crypto/scrypt.h"
+#include "crypto/hmac_sha256.h"
 //#include "util.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <new>
 #include <openssl/sha.h>
 
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
@@ -43,6 +45,10 @@
 #include <cpuid.h>
 #endif
 #endif
+#if (defined(ENABLE_AVX2) || defined(ENABLE_AVX512F)) && !defined(BUILD_herbsters_INTERNAL) && (defined(__x86_64__) || defined(__amd64__))
+#define USE_SCRYPT_MULTI_DETECT 1
+#include <cpuid.h>
+#endif
 #ifndef __FreeBSD__
 static inline uint32_t be32dec(const void *pp)
 {
@@ -254,17 +260,14 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+void scrypt_romix_generic(uint8_t *B, char *scratchpad)
 {
-	uint8_t B[128];
 	uint32_t X[32];
 	uint32_t *V;
 	uint32_t i, j, k;
 
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
 	for (k = 0; k < 32; k++)
 		X[k] = le32dec(&B[4 * k]);
 
@@ -283,7 +286,14 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
+}
 
+void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[128];
+
+	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+	scrypt_romix_generic(B, scratchpad);
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
 
@@ -327,6 +337,160 @@ std::string scrypt_detect_sse2()
 
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
+#if defined(HAVE_THREAD_LOCAL)
+	static thread_local ScryptContext context;
+	context.Hash(input, output);
+#else
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-    scrypt_1024_1_1_256_sp(input, output, scratchpad);
+	scrypt_1024_1_1_256_sp(input, output, scratchpad);
+#endif
+}
+
+ScryptContext::ScryptContext() : fHead(false)
+{
+	scratchpad = (char *)malloc(SCRYPT_SCRATCHPAD_SIZE);
+	if (scratchpad == NULL)
+		throw std::bad_alloc();
+}
+
+ScryptContext::~ScryptContext()
+{
+	free(scratchpad);
+}
+
+/*
+ * PBKDF2-HMAC-SHA256 with c = 1, starting from an HMAC already keyed with
+ * the password.  Equivalent to PBKDF2_SHA256(passwd, ..., 1, buf, dkLen).
+ */
+static void PBKDF2_SHA256_keyed(const CHMAC_SHA256 &keyed, const uint8_t *salt,
+    size_t saltlen, uint8_t *buf, size_t dkLen)
+{
+	CHMAC_SHA256 salted = keyed;
+	uint8_t ivec[4];
+	uint8_t T[32];
+	size_t i, clen;
+
+	salted.Write(salt, saltlen);
+	for (i = 0; i * 32 < dkLen; i++) {
+		be32enc(ivec, (uint32_t)(i + 1));
+		CHMAC_SHA256(salted).Write(ivec, 4).Finalize(T);
+		clen = dkLen - i * 32;
+		if (clen > 32)
+			clen = 32;
+		memcpy(&buf[i * 32], T, clen);
+	}
+}
+
+void ScryptContext::Hash(const char *input, char *output)
+{
+	const uint8_t *header = (const uint8_t *)input;
+	uint8_t khash[32];
+	uint8_t B[128];
+
+	/* The 80-byte password is longer than a SHA256 block, so the HMAC key
+	 * is SHA256(header); its first block only changes with the version,
+	 * previous block hash and most of the merkle root. */
+	if (!fHead || memcmp(head, header, 64) != 0) {
+		memcpy(head, header, 64);
+		headMidstate.Reset().Write(header, 64);
+		fHead = true;
+	}
+	CSHA256(headMidstate).Write(header + 64, 16).Finalize(khash);
+	const CHMAC_SHA256 keyed(khash, 32);
+
+	PBKDF2_SHA256_keyed(keyed, header, 80, B, 128);
+#if defined(USE_SSE2_ALWAYS)
+	scrypt_romix_sse2(B, scratchpad);
+#elif defined(USE_SSE2)
+	if (scrypt_1024_1_1_256_sp_detected == &scrypt_1024_1_1_256_sp_sse2)
+		scrypt_romix_sse2(B, scratchpad);
+	else
+		scrypt_romix_generic(B, scratchpad);
+#else
+	scrypt_romix_generic(B, scratchpad);
+#endif
+	PBKDF2_SHA256_keyed(keyed, B, 128, (uint8_t *)output, 32);
+}
+
+typedef void (*scrypt_multi_kernel)(const char *input, char *output, char *scratchpad);
+
+// Interleaved kernel and its lane count; a single lane means no kernel was selected.
+static scrypt_multi_kernel scrypt_multi_detected = NULL;
+static size_t scrypt_multi_lanes = 1;
+
+#if defined(USE_SCRYPT_MULTI_DETECT)
+/* Whether the OS saves the register state selected by mask on context switch. */
+static inline bool scrypt_xsave_enabled(uint32_t mask)
+{
+	uint32_t a, d;
+	__asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return (a & mask) == mask;
+}
+#endif
+
+std::string scrypt_detect_multi()
+{
+    scrypt_multi_detected = NULL;
+    scrypt_multi_lanes = 1;
+#if defined(USE_SCRYPT_MULTI_DETECT)
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 27 & 1) && __get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+#if defined(ENABLE_AVX512F)
+        // AVX-512F, with opmask, ZMM0-15 upper halves and ZMM16-31 enabled by the OS
+        if ((ebx >> 16 & 1) && scrypt_xsave_enabled(0xe6)) {
+            scrypt_multi_detected = &scrypt_1024_1_1_256_sp_avx512_16way;
+            scrypt_multi_lanes = 16;
+            return "scrypt: using 16-way avx512 kernel for batches";
+        }
+#endif
+#if defined(ENABLE_AVX2)
+        // AVX2, with YMM state enabled by the OS
+        if ((ebx >> 5 & 1) && scrypt_xsave_enabled(0x06)) {
+            scrypt_multi_detected = &scrypt_1024_1_1_256_sp_avx2_8way;
+            scrypt_multi_lanes = 8;
+            return "scrypt: using 8-way avx2 kernel for batches";
+        }
+#endif
+    }
+#endif
+    return "scrypt: no multi-lane kernel available, batches are hashed one at a time";
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n)
+{
+	const scrypt_multi_kernel kernel = scrypt_multi_detected;
+	const size_t lanes = scrypt_multi_lanes;
+	char *scratchpad = NULL;
+	size_t i = 0;
+
+	if (kernel != NULL && n > 1)
+		scratchpad = (char *)malloc(SCRYPT_MULTI_SCRATCHPAD_SIZE(lanes));
+
+	if (scratchpad != NULL) {
+		for (; i + lanes <= n; i += lanes)
+			kernel(input + 80 * i, output + 32 * i, scratchpad);
+
+		/* Pad a partial batch by repeating its last input; one more
+		 * interleaved pass is cheaper than hashing the tail serially. */
+		if (n - i > 1) {
+			char padin[80 * 16];
+			char padout[32 * 16];
+			size_t m = n - i, l;
+
+			memcpy(padin, input + 80 * i, 80 * m);
+			for (l = m; l < lanes; l++)
+				memcpy(padin + 80 * l, input + 80 * (n - 1), 80);
+			kernel(padin, padout, scratchpad);
+			memcpy(output + 32 * i, padout, 32 * m);
+			i = n;
+		}
+		free(scratchpad);
+	}
+
+	if (i < n) {
+		char sp[SCRYPT_SCRATCHPAD_SIZE];
+		for (; i < n; i++)
+			scrypt_1024_1_1_256_sp(input + 80 * i, output + 32 * i, sp);
+	}
 }
@@ -1,15 +1,24 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/herbsters-config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <string>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+#include "crypto/sha256.h"
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
+/** Apply the scrypt ROMix step (N=1024, r=1) in place to the 128-byte PBKDF2 output B. */
+void scrypt_romix_generic(uint8_t *B, char *scratchpad);
 
 #if defined(USE_SSE2)
-#include <string>
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_sse2((input), (output), (scratchpad))
@@ -19,11 +28,59 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 std::string scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+void scrypt_romix_sse2(uint8_t *B, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/** Scratchpad needed by the interleaved kernels: one 128 KiB region per lane. */
+#define SCRYPT_MULTI_SCRATCHPAD_SIZE(lanes) (131072 * (lanes) + 63)
+
+/**
+ * Hash n consecutive 80-byte inputs into n consecutive 32-byte outputs.
+ * Uses the widest interleaved kernel selected by scrypt_detect_multi(), and
+ * falls back to one-at-a-time hashing when none is available.
+ */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n);
+
+/** Select the multi-lane kernel supported by this CPU. Returns a description. */
+std::string scrypt_detect_multi();
+
+#if defined(ENABLE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
+#endif
+#if defined(ENABLE_AVX512F)
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *input, char *output, char *scratchpad);
+#endif
+
+/**
+ * Reusable state for hashing 80-byte block headers with scrypt_1024_1_1_256.
+ *
+ * Owns a heap scratchpad instead of placing 128 KiB on the stack per call,
+ * derives the HMAC-SHA256 key schedule once per header rather than once per
+ * PBKDF2 pass, and keeps the SHA256 midstate of the first 64 header bytes so
+ * that headers differing only in nTime/nBits/nNonce skip that block as well.
+ * Not thread safe; use one context per thread.
+ */
+class ScryptContext
+{
+private:
+    char* scratchpad;
+    unsigned char head[64];
+    CSHA256 headMidstate;
+    bool fHead;
+
+public:
+    ScryptContext();
+    ~ScryptContext();
+    ScryptContext(const ScryptContext&) = delete;
+    ScryptContext& operator=(const ScryptContext&) = delete;
+
+    /** Hash one 80-byte input into a 32-byte output; same result as scrypt_1024_1_1_256. */
+    void Hash(const char* input, char* output);
+};
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -73,14 +73,63 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/** Get a -db* option for the named database: a <name>:<value> entry wins over a plain value. */
+static int64_t GetDBArg(const std::string& strArg, const std::string& name, int64_t nDefault)
+{
+    int64_t nValue = nDefault;
+    bool fNamed = false;
+    for (const std::string& strValue : gArgs.GetArgs(strArg)) {
+        size_t pos = strValue.find(':');
+        if (pos == std::string::npos) {
+            if (!fNamed)
+                nValue = atoi64(strValue);
+        } else if (strValue.substr(0, pos) == name) {
+            nValue = atoi64(strValue.substr(pos + 1));
+            fNamed = true;
+        }
+    }
+    return nValue;
+}
+
+bool CheckDBOptions(std::string& strError)
+{
+    // Zero disables the bloom filters; the sizes and file limit must be positive
+    static const std::pair<const char*, int64_t> vMinimums[] = {
+        {"-dbmaxopenfiles", 1}, {"-dbblocksize", 1}, {"-dbbloombits", 0}, {"-dbwritebuffer", 1},
+    };
+    for (const auto& minimum : vMinimums) {
+        for (const std::string& strValue : gArgs.GetArgs(minimum.first)) {
+            size_t pos = strValue.find(':');
+            if (atoi64(pos == std::string::npos ? strValue : strValue.substr(pos + 1)) < minimum.second) {
+                strError = strprintf("Invalid %s value: '%s'", minimum.first, strValue);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+CDBOptions GetDBOptions(const std::string& name)
+{
+    CDBOptions dboptions;
+    dboptions.nMaxOpenFiles = std::max<int64_t>(1, std::min<int64_t>(GetDBArg("-dbmaxopenfiles", name, DEFAULT_DB_MAX_OPEN_FILES), 50000));
+    dboptions.nBlockSize = std::max<int64_t>(1024, std::min<int64_t>(GetDBArg("-dbblocksize", name, DEFAULT_DB_BLOCK_SIZE), 4 << 20));
+    dboptions.fCompression = GetDBArg("-dbcompression", name, DEFAULT_DB_COMPRESSION) != 0;
+    dboptions.nBloomBits = std::max<int64_t>(0, std::min<int64_t>(GetDBArg("-dbbloombits", name, DEFAULT_DB_BLOOM_BITS), 64));
+    dboptions.nWriteBufferSize = std::max<int64_t>(0, std::min<int64_t>(GetDBArg("-dbwritebuffer", name, 0), 1024)) << 20;
+    return dboptions;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dboptions)
 {
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    // up to two write buffers may be held in memory simultaneously
+    options.write_buffer_size = dboptions.nWriteBufferSize ? dboptions.nWriteBufferSize : nCacheSize / 4;
+    options.block_size = dboptions.nBlockSize;
+    options.filter_policy = dboptions.nBloomBits ? leveldb::NewBloomFilterPolicy(dboptions.nBloomBits) : nullptr;
+    options.compression = dboptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dboptions.nMaxOpenFiles;
     options.info_log = new CherbstersLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -97,7 +146,9 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    name = path.filename().string();
+    dboptions = ::GetDBOptions(name);
+    options = GetOptions(nCacheSize, dboptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -111,6 +162,8 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
         TryCreateDirectories(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
     }
+    LogPrint(BCLog::LEVELDB, "LevelDB options for %s: max_open_files=%d block_size=%u compression=%d bloom_bits=%d write_buffer_size=%u\n",
+        name, options.max_open_files, options.block_size, dboptions.fCompression, dboptions.nBloomBits, options.write_buffer_size);
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
@@ -13,12 +13,42 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <algorithm>
+#include <memory>
+
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+//! -dbmaxopenfiles default
+static const int DEFAULT_DB_MAX_OPEN_FILES = 64;
+//! -dbblocksize default, in bytes (LevelDB's own default)
+static const int DEFAULT_DB_BLOCK_SIZE = 4096;
+//! -dbcompression default
+static const bool DEFAULT_DB_COMPRESSION = false;
+//! -dbbloombits default
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+
+/**
+ * LevelDB settings of one database. Each setting comes from a -db* option,
+ * which takes either a value for all databases or <name>:<value> for the
+ * database in the directory <name> (chainstate, index); the latter wins.
+ */
+struct CDBOptions
+{
+    int nMaxOpenFiles;
+    size_t nBlockSize;
+    bool fCompression;
+    int nBloomBits;            //!< 0 disables the bloom filter
+    size_t nWriteBufferSize;   //!< 0 uses a quarter of the cache size
+};
+
+/** Check the values of the -db* options, setting strError on the first out of range one. */
+bool CheckDBOptions(std::string& strError);
+CDBOptions GetDBOptions(const std::string& name);
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -180,6 +210,12 @@ private:
     //! custom environment this database is using (may be nullptr in case of default environment)
     leveldb::Env* penv;
 
+    //! name of the database, the last component of its path
+    std::string name;
+
+    //! database settings from the command line
+    CDBOptions dboptions;
+
     //! database options used
     leveldb::Options options;
 
@@ -212,7 +248,8 @@ private:
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] nCacheSize  Configures various leveldb cache settings; the
+     *                        other settings are taken from GetDBOptions().
      * @param[in] fMemory     If true, use leveldb's memory environment.
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
@@ -247,6 +284,58 @@ public:
         return true;
     }
 
+    /**
+     * Read the values of several keys at once. The keys are visited in
+     * database order by a single iterator, so neighbouring keys share the
+     * table and block lookups that separate Reads would repeat.
+     * On return found[i] tells whether values[i] holds the value of keys[i].
+     * Returns the number of keys found.
+     */
+    template <typename K, typename V>
+    size_t ReadMany(const std::vector<K>& keys, std::vector<V>& values, std::vector<bool>& found) const
+    {
+        values.resize(keys.size());
+        found.assign(keys.size(), false);
+
+        std::vector<std::string> vKeys(keys.size());
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        for (size_t i = 0; i < keys.size(); i++) {
+            ssKey << keys[i];
+            vKeys[i].assign(ssKey.data(), ssKey.size());
+            ssKey.clear();
+        }
+        std::vector<size_t> vOrder(keys.size());
+        for (size_t i = 0; i < vOrder.size(); i++)
+            vOrder[i] = i;
+        std::sort(vOrder.begin(), vOrder.end(), [&vKeys](size_t a, size_t b) { return vKeys[a] < vKeys[b]; });
+
+        size_t nFound = 0;
+        std::unique_ptr<leveldb::Iterator> pit(pdb->NewIterator(readoptions));
+        for (size_t i : vOrder) {
+            leveldb::Slice slKey(vKeys[i]);
+            pit->Seek(slKey);
+            if (!pit->Valid())
+                break; // all remaining keys are past the end
+            if (pit->key() != slKey)
+                continue;
+            try {
+                CDataStream ssValue(pit->value().data(), pit->value().data() + pit->value().size(), SER_DISK, CLIENT_VERSION);
+                ssValue.Xor(obfuscate_key);
+                ssValue >> values[i];
+            } catch (const std::exception&) {
+                continue;
+            }
+            found[i] = true;
+            nFound++;
+        }
+        if (!pit->status().ok()) {
+            LogPrintf("LevelDB read failure: %s\n", pit->status().ToString());
+            dbwrapper_private::HandleError(pit->status());
+        }
+        return nFound;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -306,6 +395,18 @@ public:
      */
     bool IsEmpty();
 
+    const std::string& GetName() const { return name; }
+    const CDBOptions& GetDBOptions() const { return dboptions; }
+
+    /**
+     * Read a LevelDB property such as "leveldb.stats" or
+     * "leveldb.approximate-memory-usage".
+     */
+    bool GetProperty(const std::string& property, std::string& value) const
+    {
+        return pdb->GetProperty(property, &value);
+    }
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
@@ -11,11 +11,14 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
+#include "blockfilereader.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
@@ -66,10 +69,6 @@
 #include "zmq/zmqnotificationinterface.h"
 #endif
 
-#ifdef USE_SSE2
-#include "crypto/scrypt.h"
-#endif
-
 bool fFeeEstimatesInitialized = false;
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
@@ -145,16 +144,28 @@ public:
         try {
             return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
-            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
-            LogPrintf("Error reading from database: %s\n", e.what());
-            // Starting the shutdown sequence and returning false to the caller would be
-            // interpreted as 'entry not found' (as opposed to unable to read data), and
-            // could lead to invalid interpretation. Just exit immediately, as we can't
-            // continue anyway, and all writes should be atomic.
-            abort();
+            HandleReadError(e);
+        }
+    }
+    size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const override {
+        try {
+            return CCoinsViewBacked::GetCoins(outpoints, coins, count);
+        } catch(const std::runtime_error& e) {
+            HandleReadError(e);
         }
     }
     // Writes do not need similar protection, as failure to write is handled by the caller.
+
+private:
+    [[noreturn]] static void HandleReadError(const std::runtime_error& e) {
+        uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+        LogPrintf("Error reading from database: %s\n", e.what());
+        // Starting the shutdown sequence and returning false to the caller would be
+        // interpreted as 'entry not found' (as opposed to unable to read data), and
+        // could lead to invalid interpretation. Just exit immediately, as we can't
+        // continue anyway, and all writes should be atomic.
+        abort();
+    }
 };
 
 static CCoinsViewErrorCatcher *pcoinscatcher = nullptr;
@@ -347,6 +358,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep recently connected and served blocks in memory, up to <n> megabytes (0 to disable, default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-blockfilemappings=<n>", strprintf("Number of block and undo files kept memory-mapped for reading blocks, 0 to read them with file I/O (default: %u, 0 on 32-bit systems)", DEFAULT_BLOCKFILE_MAPPINGS));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -361,11 +375,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt("-dbblocksize=[<db>:]<n>", strprintf("LevelDB block size in bytes (default: %u)", DEFAULT_DB_BLOCK_SIZE));
+        strUsage += HelpMessageOpt("-dbbloombits=[<db>:]<n>", strprintf("Bits per key of the LevelDB bloom filters, 0 to disable them (default: %u)", DEFAULT_DB_BLOOM_BITS));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbcacheretain=<n>", strprintf(_("Percentage of the UTXO cache kept filled with the most recently created coins when it is flushed for being full (0 to %d, 0 empties it, default: %d)"), MAX_DBCACHE_RETAIN, DEFAULT_DBCACHE_RETAIN));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-dbcompression=[<db>:]<n>", strprintf("Compress LevelDB blocks with Snappy, if LevelDB was built with it (default: %u)", DEFAULT_DB_COMPRESSION));
+        strUsage += HelpMessageOpt("-dbmaxopenfiles=[<db>:]<n>", strprintf("Maximum number of files LevelDB keeps open, for all databases or for <db> (chainstate, index) (default: %u)", DEFAULT_DB_MAX_OPEN_FILES));
+        strUsage += HelpMessageOpt("-dbwritebuffer=[<db>:]<n>", "LevelDB write buffer size in megabytes (default: a quarter of the database's share of -dbcache)");
+    }
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Initialize an empty chainstate from a UTXO set snapshot written by dumptxoutset, and continue syncing from its base block. Earlier blocks are not downloaded or validated. Requires -loadtxoutsethash"));
+    strUsage += HelpMessageOpt("-loadtxoutsethash=<hash>:<hash>", _("The base block hash and hash_serialized_2 that the -loadtxoutset snapshot must have, as reported by dumptxoutset on a node you trust"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -388,6 +412,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-verifyindexpow", strprintf(_("Re-verify the proof of work of every block index entry in the background after startup, shutting down on a mismatch (default: %u)"), DEFAULT_VERIFYINDEXPOW));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -406,6 +431,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Number of threads to process peer messages, with peers divided among them (1 to %d, default: %d)"), MAX_MSGHAND_THREADS, DEFAULT_MSGHAND_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -508,6 +534,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-genthreads=<n>", strprintf(_("Number of threads the generate and generatetoaddress RPCs grind nonces with (-1 = one per core, default: %d)"), DEFAULT_GENERATE_THREADS));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -923,17 +950,35 @@ bool AppInitParameterInteraction()
         return InitError("Cannot set -bind or -whitebind together with -listen=0");
     }
 
-    // Make sure enough file descriptors are available
+    std::string strDBError;
+    if (!CheckDBOptions(strDBError))
+        return InitError(strDBError);
+    if (gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize) <= 0)
+        return InitError(strprintf("Invalid -dbbatchsize value: '%s'", gArgs.GetArg("-dbbatchsize", "")));
+
+    // Make sure enough file descriptors are available, including those of
+    // databases allowed more open files than the default
     int nBind = std::max(nUserBind, size_t(1));
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS;
+    for (const char* name : {"chainstate", "index"}) {
+        nCoreFD += std::max(0, GetDBOptions(name).nMaxOpenFiles - DEFAULT_DB_MAX_OPEN_FILES);
+    }
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+#ifdef USE_EPOLL
+    // Peer sockets are not limited to FD_SETSIZE, but the listening
+    // sockets and the epoll set need descriptors too
+    nCoreFD += nBind + 1;
+#else
+    // Peer sockets have to fit into an fd_set for select()
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD - MAX_ADDNODE_CONNECTIONS)), 0);
+#endif
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD + MAX_ADDNODE_CONNECTIONS);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nCoreFD - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -1036,6 +1081,11 @@ bool AppInitParameterInteraction()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // Whole block files are mapped, which takes more address space than 32-bit systems have to spare
+    const int64_t nBlockFileMappingsDefault = sizeof(void*) >= 8 ? DEFAULT_BLOCKFILE_MAPPINGS : 0;
+    g_blockfilereader.SetMaxMappings(std::max<int64_t>(0, gArgs.GetArg("-blockfilemappings", nBlockFileMappingsDefault)));
+    g_blockcache.SetMaxUsage(std::max<int64_t>(0, gArgs.GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE)) << 20);
+
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
     int64_t nPruneArg = gArgs.GetArg("-prune", 0);
     if (nPruneArg < 0) {
@@ -1254,6 +1304,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPoWCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxDecode);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinPrefetch);
     }
 
     // Start the lightweight task scheduler thread
@@ -1280,6 +1336,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     std::string sse2detect = scrypt_detect_sse2();
     LogPrintf("%s\n", sse2detect);
 #endif
+    LogPrintf("%s\n", scrypt_detect_multi());
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1415,6 +1472,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    nCoinCacheRetain = std::max(0, std::min(MAX_DBCACHE_RETAIN, (int)gArgs.GetArg("-dbcacheretain", DEFAULT_DBCACHE_RETAIN)));
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
@@ -1504,10 +1562,28 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // A no-op unless the database predates the rolling UTXO set hash
+                if (!pcoinsdbview->InitUTXOSetHash()) {
+                    strLoadError = _("Error computing UTXO set hash");
+                    break;
+                }
+
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
+
+                // A UTXO snapshot load that was interrupted leaves a partial set behind.
+                bool fLoadingTxOutSet = false;
+                pblocktree->ReadFlag("txoutsetloading", fLoadingTxOutSet);
+                if (fLoadingTxOutSet) {
+                    if (!is_coinsview_empty) {
+                        strLoadError = _("Loading a UTXO snapshot was interrupted. You need to rebuild the database using -reindex-chainstate");
+                        break;
+                    }
+                    pblocktree->WriteFlag("txoutsetloading", false);
+                }
+
                 if (!is_coinsview_empty) {
                     // LoadChainTip sets chainActive based on pcoinsTip's best block
                     if (!LoadChainTip(chainparams)) {
@@ -1594,6 +1670,42 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
     }
 
+    if (gArgs.IsArgSet("-loadtxoutset")) {
+        uint256 hashBestBlock;
+        {
+            LOCK(cs_main);
+            hashBestBlock = pcoinsTip->GetBestBlock();
+        }
+        if (!hashBestBlock.IsNull() && hashBestBlock != chainparams.GetConsensus().hashGenesisBlock) {
+            LogPrintf("Ignoring -loadtxoutset, the chainstate is past the genesis block\n");
+        } else if (fReindex) {
+            return InitError(_("-loadtxoutset cannot be combined with -reindex."));
+        } else {
+            // The snapshot is only as trustworthy as these hashes: anyone can
+            // write a file with a self-consistent trailer.
+            const std::string strHashes = gArgs.GetArg("-loadtxoutsethash", "");
+            const size_t nSep = strHashes.find(':');
+            const std::string strHashBlock = strHashes.substr(0, nSep);
+            const std::string strHashSerialized = nSep == std::string::npos ? "" : strHashes.substr(nSep + 1);
+            if (strHashBlock.size() != 64 || !IsHex(strHashBlock) || strHashSerialized.size() != 64 || !IsHex(strHashSerialized)) {
+                return InitError(_("-loadtxoutset requires -loadtxoutsethash=<base block hash>:<hash_serialized_2>"));
+            }
+            uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+            std::string strError;
+            if (!LoadTxOutSet(chainparams, gArgs.GetArg("-loadtxoutset", ""), uint256S(strHashBlock), uint256S(strHashSerialized), strError)) {
+                if (fRequestShutdown) {
+                    LogPrintf("Shutdown requested. Exiting.\n");
+                    return false;
+                }
+                return InitError(strprintf(_("Unable to load UTXO snapshot: %s"), strError));
+            }
+        }
+    }
+
+    if (gArgs.GetBoolArg("-verifyindexpow", DEFAULT_VERIFYINDEXPOW) && !fReindex) {
+        StartVerifyIndexPoW(threadGroup, std::max(nScriptCheckThreads, 1), chainparams.GetConsensus());
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1622,6 +1734,12 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    // A chain loaded from a UTXO snapshot cannot serve the blocks up to its base either
+    if (HaveAssumedValidBlocksWithoutData()) {
+        LogPrintf("Unsetting NODE_NETWORK on a chain loaded from a UTXO snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     if (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertise witness capabilities if they have a reasonable start time.
         // This allows us to have the code merged without a defined softfork, by setting its
@@ -1689,6 +1807,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     connOptions.nBestHeight = chainActive.Height();
     connOptions.uiInterface = &uiInterface;
     connOptions.m_msgproc = peerLogic.get();
+    connOptions.nMessageHandlerThreads = std::max(1, std::min((int)gArgs.GetArg("-msghandthreads", DEFAULT_MSGHAND_THREADS), MAX_MSGHAND_THREADS));
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
 
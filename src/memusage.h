@@ -6,6 +6,8 @@
 #define herbsters_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "prevector.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -164,6 +166,17 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/** For a map backed by a PoolResource, count the pool's chunks rather than its nodes. */
+template<typename X, typename Y, typename Z, typename E, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, E, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const auto* resource = m.get_allocator().resource();
+    // The chunk pointers are kept in a std::list: three pointers per node.
+    const size_t usage_chunk_list = MallocUsage(sizeof(void*) * 3) * resource->NumAllocatedChunks();
+    const size_t usage_chunks = MallocUsage(resource->ChunkSizeBytes()) * resource->NumAllocatedChunks();
+    return usage_chunk_list + usage_chunks + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // herbsters_MEMUSAGE_H
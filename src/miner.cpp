@@ -29,7 +29,9 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
 #include <queue>
+#include <thread>
 #include <utility>
 
 //////////////////////////////////////////////////////////////////////////////
@@ -458,3 +460,47 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+/** Nonces hashed per GetPoWHashes call while grinding; a multiple of every scrypt lane count. */
+static const uint32_t GENERATE_NONCE_BATCH = 64;
+
+uint32_t GrindBlockNonce(CBlock* pblock, uint32_t nLimit, int nThreads, const Consensus::Params& consensusParams)
+{
+    const CBlockHeader header = pblock->GetBlockHeader();
+    std::atomic<uint32_t> nNextBatch(0);
+    std::atomic<uint32_t> nBestNonce(nLimit);
+
+    auto worker = [&]() {
+        std::vector<CBlockHeader> vHeaders(GENERATE_NONCE_BATCH, header);
+        std::vector<uint256> vHashes(GENERATE_NONCE_BATCH);
+        while (true) {
+            const uint32_t nStart = nNextBatch.fetch_add(GENERATE_NONCE_BATCH);
+            if (nStart >= nLimit || nStart >= nBestNonce.load())
+                return;
+            const uint32_t nCount = std::min(GENERATE_NONCE_BATCH, nLimit - nStart);
+            for (uint32_t i = 0; i < nCount; i++)
+                vHeaders[i].nNonce = nStart + i;
+            GetPoWHashes(vHeaders.data(), nCount, vHashes.data());
+            for (uint32_t i = 0; i < nCount; i++) {
+                if (CheckProofOfWork(vHashes[i], header.nBits, consensusParams)) {
+                    uint32_t nBest = nBestNonce.load();
+                    while (nStart + i < nBest && !nBestNonce.compare_exchange_weak(nBest, nStart + i)) {}
+                    break;
+                }
+            }
+        }
+    };
+
+    if (nThreads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back(worker);
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    pblock->nNonce = nBestNonce.load();
+    return pblock->nNonce == nLimit ? nLimit : pblock->nNonce + 1;
+}
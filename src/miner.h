@@ -21,6 +21,10 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genthreads, the number of threads generate/generatetoaddress grind nonces with */
+static const int DEFAULT_GENERATE_THREADS = 1;
+/** Maximum number of nonce grinding threads */
+static const int MAX_GENERATE_THREADS = 64;
 
 struct CBlockTemplate
 {
@@ -205,5 +209,14 @@ private:
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Search nonces [0, nLimit) of pblock for a valid proof of work using nThreads
+ * workers. Workers claim batches in increasing order and stop claiming once a
+ * batch starts past the best solution, so the lowest valid nonce is always the
+ * one returned, whatever the thread count. Returns the number of nonces spent
+ * (winning nonce + 1, or nLimit when nothing was found) and leaves pblock->nNonce
+ * at the solution or at nLimit.
+ */
+uint32_t GrindBlockNonce(CBlock* pblock, uint32_t nLimit, int nThreads, const Consensus::Params& consensusParams);
 
 #endif // herbsters_MINER_H
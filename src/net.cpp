@@ -44,6 +44,25 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+#ifdef WIN32
+// Windows has no sendmsg(), queued buffers are sent one at a time
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+static const size_t MAX_SEND_BUFFERS = 2;
+#else
+/** Maximum number of buffers (two per message) sent with one sendmsg() */
+static const size_t MAX_SEND_BUFFERS = 64;
+#endif
+
+#ifdef USE_EPOLL
+/** Maximum number of socket events handled per epoll_wait() */
+static const int MAX_SOCKET_EVENTS = 256;
+/** Time to wait for socket events, after which paused receives and disconnects are looked at again (in milliseconds) */
+static const int SOCKET_WAIT_MSECS = 50;
+#endif
+
 #if !defined(HAVE_MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -847,27 +866,62 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // Gather the unsent headers and payloads of as many queued messages
+        // as fit into one call, starting nSendOffset bytes into the first.
+        struct iovec iov[MAX_SEND_BUFFERS];
+        size_t nBuffers = 0;
+        size_t nGathered = 0;
+        size_t nSkip = pnode->nSendOffset;
+        assert((*it)->size() > nSkip);
+        for (auto itGather = it; itGather != pnode->vSendMsg.end() && nBuffers + 2 <= MAX_SEND_BUFFERS; ++itGather) {
+            for (const std::vector<unsigned char>* part : {&(*itGather)->header, &(*itGather)->data}) {
+                if (part->size() <= nSkip) {
+                    nSkip -= part->size();
+                    continue;
+                }
+                iov[nBuffers].iov_base = (void*)(part->data() + nSkip);
+                iov[nBuffers].iov_len = part->size() - nSkip;
+                nGathered += iov[nBuffers].iov_len;
+                nBuffers++;
+                nSkip = 0;
+            }
+        }
+
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(iov[0].iov_base), iov[0].iov_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nGathered = iov[0].iov_len;
+#else
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nBuffers;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that were sent completely
+            size_t nAdvance = nBytes;
+            while (nAdvance > 0) {
+                size_t nLeft = (*it)->size() - pnode->nSendOffset;
+                if (nAdvance < nLeft) {
+                    pnode->nSendOffset += nAdvance;
+                    break;
+                }
+                nAdvance -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nGathered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1114,15 +1168,127 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+#ifdef USE_EPOLL
+    if (!AddSocketEvents(hSocket, pnode, true))
+        pnode->CloseSocketDisconnect();
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
+#ifdef USE_EPOLL
+bool CConnman::AddSocketEvents(SOCKET hSocket, void* ptr, bool fEdgeTriggered)
+{
+    struct epoll_event event = {};
+    event.events = fEdgeTriggered ? (EPOLLIN | EPOLLOUT | EPOLLET) : EPOLLIN;
+    event.data.ptr = ptr;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &event) == SOCKET_ERROR) {
+        LogPrintf("epoll_ctl() failed: %s\n", NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool CConnman::SocketRecvData(CNode *pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler(pnode);
+        }
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return nBytes == (int)sizeof(pchBuf);
+}
+
+void CConnman::InactivityCheck(CNode *pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    // Nodes whose sockets may have data left to read
+    std::set<CNode*> setRecvReady;
+    int64_t nLastInactivityCheck = 0;
+#endif
     while (!interruptNet)
     {
         //
@@ -1138,6 +1304,9 @@ void CConnman::ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef USE_EPOLL
+                    setRecvReady.erase(pnode);
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1186,6 +1355,110 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef USE_EPOLL
+        //
+        // Wait for socket events. Peer sockets are registered edge-triggered
+        // for reading and writing when they are added, so only nodes whose
+        // sockets changed state, or that still have data to read from an
+        // earlier round, are serviced. As with select() below, a node that has
+        // data waiting to be sent is not read from until that is drained.
+        //
+        bool fRecvBacklog = false;
+        for (CNode* pnode : setRecvReady) {
+            if (pnode->fPauseRecv)
+                continue;
+            LOCK(pnode->cs_vSend);
+            if (pnode->vSendMsg.empty()) {
+                fRecvBacklog = true;
+                break;
+            }
+        }
+
+        struct epoll_event events[MAX_SOCKET_EVENTS];
+        int nEvents = epoll_wait(epollfd, events, MAX_SOCKET_EVENTS, fRecvBacklog ? 0 : SOCKET_WAIT_MSECS);
+        if (interruptNet)
+            return;
+
+        if (nEvents == SOCKET_ERROR)
+        {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR) {
+                LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+                if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_WAIT_MSECS)))
+                    return;
+            }
+            nEvents = 0;
+        }
+
+        //
+        // Accept new connections, and note which nodes are ready. Nodes are
+        // only deleted by this thread, after their sockets have been closed
+        // (which removes them from the epoll set), so the pointers stay valid.
+        //
+        std::set<CNode*> setSendReady;
+        for (int i = 0; i < nEvents; i++)
+        {
+            const ListenSocket* pListenSocket = nullptr;
+            for (const ListenSocket& hListenSocket : vhListenSocket) {
+                if (events[i].data.ptr == &hListenSocket)
+                    pListenSocket = &hListenSocket;
+            }
+            if (pListenSocket) {
+                AcceptConnection(*pListenSocket);
+                continue;
+            }
+
+            CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                pnode->fRecvReady = true;
+                setRecvReady.insert(pnode);
+            }
+            if (events[i].events & EPOLLOUT)
+                setSendReady.insert(pnode);
+        }
+
+        //
+        // Service the ready sockets
+        //
+        std::set<CNode*> setNodesReady(setRecvReady);
+        setNodesReady.insert(setSendReady.begin(), setSendReady.end());
+        for (CNode* pnode : setNodesReady)
+        {
+            if (interruptNet)
+                return;
+
+            bool fSendPending;
+            {
+                LOCK(pnode->cs_vSend);
+                if (setSendReady.count(pnode) && !pnode->vSendMsg.empty()) {
+                    size_t nBytes = SocketSendData(pnode);
+                    if (nBytes) {
+                        RecordBytesSent(nBytes);
+                    }
+                }
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+
+            // A read that does not fill the buffer leaves the socket empty;
+            // the next data to arrive raises a new event.
+            if (pnode->fRecvReady && !pnode->fPauseRecv && !fSendPending) {
+                pnode->fRecvReady = SocketRecvData(pnode);
+                if (!pnode->fRecvReady)
+                    setRecvReady.erase(pnode);
+            }
+        }
+
+        //
+        // Inactivity checking, once a second
+        //
+        int64_t nTime = GetSystemTimeInSeconds();
+        if (nTime != nLastInactivityCheck) {
+            nLastInactivityCheck = nTime;
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes)
+                InactivityCheck(pnode);
+        }
+#else
         //
         // Find which sockets have data to receive
         //
@@ -1310,57 +1583,7 @@ void CConnman::ThreadSocketHandler()
             }
             if (recvSet || errorSet)
             {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET)
-                        continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                }
-                if (nBytes > 0)
-                {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                        pnode->CloseSocketDisconnect();
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                }
-                else if (nBytes == 0)
-                {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-                else if (nBytes < 0)
-                {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                    {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
+                SocketRecvData(pnode);
             }
 
             //
@@ -1378,41 +1601,14 @@ void CConnman::ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodesCopy)
                 pnode->Release();
         }
+#endif
     }
 }
 
@@ -1420,9 +1616,22 @@ void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        for (size_t i = 0; i < vMsgProcWake.size(); i++)
+            vMsgProcWake[i] = true;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler(const CNode* pnode)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        if (vMsgProcWake.empty())
+            return;
+        vMsgProcWake[pnode->GetId() % vMsgProcWake.size()] = true;
+    }
+    // All handler threads wait on the same condition; the others go back to sleep.
+    condMsgProc.notify_all();
 }
 
 
@@ -1995,6 +2204,13 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->m_manual_connection = true;
 
     m_msgproc->InitializeNode(pnode);
+#ifdef USE_EPOLL
+    {
+        LOCK(pnode->cs_hSocket);
+        if (!AddSocketEvents(pnode->hSocket, pnode, true))
+            pnode->fDisconnect = true;
+    }
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -2003,15 +2219,17 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nShard)
 {
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (pnode->GetId() % nMessageHandlerThreads != nShard)
+                    continue;
+                vNodesCopy.push_back(pnode);
                 pnode->AddRef();
             }
         }
@@ -2046,9 +2264,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nShard] { return vMsgProcWake[nShard]; });
         }
-        fMsgProcWake = false;
+        vMsgProcWake[nShard] = false;
     }
 }
 
@@ -2236,8 +2454,12 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nLastNodeId = 0;
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
+    nMessageHandlerThreads = 1;
     semOutbound = nullptr;
     semAddnode = nullptr;
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
     flagInterruptMsgProc = false;
     SetTryNewOutboundPeer(false);
 
@@ -2299,6 +2521,18 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         return false;
     }
 
+#ifdef USE_EPOLL
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        LogPrintf("epoll_create1() failed: %s\n", NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (!AddSocketEvents(hListenSocket.socket, (void*)&hListenSocket, false))
+            return false;
+    }
+#endif
+
     for (const auto& strDest : connOptions.vSeedNodes) {
         AddOneShot(strDest);
     }
@@ -2360,7 +2594,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcWake.assign(nMessageHandlerThreads, false);
     }
 
     // Send and receive from sockets, accept connections
@@ -2378,8 +2612,11 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     if (!gArgs.IsArgSet("-connect") || gArgs.GetArgs("-connect").size() != 1 || gArgs.GetArgs("-connect")[0] != "0")
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
-    // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    // Process messages, with peers sharded across the message handler threads
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        const std::string strThreadName = nMessageHandlerThreads == 1 ? "msghand" : strprintf("msghand.%d", i);
+        threadMessageHandlers.emplace_back([this, i, strThreadName] { TraceThread(strThreadName.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))); });
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2428,8 +2665,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& thread : threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2452,6 +2692,12 @@ void CConnman::Stop()
         if (hListenSocket.socket != INVALID_SOCKET)
             if (!CloseSocket(hListenSocket.socket))
                 LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
 
     // clean up some globals (to help leak detection)
     for (CNode *pnode : vNodes) {
@@ -2767,6 +3013,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fRecvReady = false;
+    fBanCheckPending = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2827,19 +3075,30 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CPreparedNetMsgRef CConnman::PrepareMessage(CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
-
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    std::shared_ptr<CPreparedNetMsg> pmsg = std::make_shared<CPreparedNetMsg>();
+    pmsg->header.reserve(CMessageHeader::HEADER_SIZE);
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, pmsg->header, 0, hdr};
+    pmsg->command = std::move(msg.command);
+    pmsg->data = std::move(msg.data);
+    return pmsg;
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, PrepareMessage(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CPreparedNetMsgRef& msg)
+{
+    size_t nMessageSize = msg->data.size();
+    size_t nTotalSize = msg->size();
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg->command.c_str()), nMessageSize, pnode->GetId());
 
     size_t nBytesSent = 0;
     {
@@ -2847,14 +3106,12 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[msg->command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(msg);
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
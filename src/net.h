@@ -73,6 +73,10 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** -msghandthreads default: the number of threads peers are sharded across for message processing */
+static const int DEFAULT_MSGHAND_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 /** The default for -maxuploadtarget. 0 = Unlimited */
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** The default timeframe for -maxuploadtarget. 1 day. */
@@ -115,6 +119,21 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * A message serialized together with its header, ready to be sent. It is
+ * shared and never modified once made, so the same message can be queued
+ * to any number of peers without copying it.
+ */
+struct CPreparedNetMsg
+{
+    std::string command;
+    std::vector<unsigned char> header;
+    std::vector<unsigned char> data;
+
+    size_t size() const { return header.size() + data.size(); }
+};
+typedef std::shared_ptr<const CPreparedNetMsg> CPreparedNetMsgRef;
+
 class NetEventsInterface;
 class CConnman
 {
@@ -138,6 +157,7 @@ public:
         int nBestHeight = 0;
         CClientUIInterface* uiInterface = nullptr;
         NetEventsInterface* m_msgproc = nullptr;
+        int nMessageHandlerThreads = 1;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
@@ -157,6 +177,7 @@ public:
         nBestHeight = connOptions.nBestHeight;
         clientInterface = connOptions.uiInterface;
         m_msgproc = connOptions.m_msgproc;
+        nMessageHandlerThreads = std::max(1, connOptions.nMessageHandlerThreads);
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -176,7 +197,10 @@ public:
 
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
+    /** Add the message header to msg, so that it can be pushed to several peers. */
+    static CPreparedNetMsgRef PrepareMessage(CSerializedNetMsg&& msg);
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CPreparedNetMsgRef& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -308,6 +332,8 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+    /** Wake only the message handler thread that processes pnode. */
+    void WakeMessageHandler(const CNode* pnode);
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -323,9 +349,14 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nShard);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
+    bool SocketRecvData(CNode *pnode);
+    void InactivityCheck(CNode *pnode);
+#ifdef USE_EPOLL
+    bool AddSocketEvents(SOCKET hSocket, void* ptr, bool fEdgeTriggered);
+#endif
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -381,6 +412,10 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+#ifdef USE_EPOLL
+    /** epoll set of the listening and peer sockets, created in Start() */
+    int epollfd;
+#endif
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -415,8 +450,14 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Peers are sharded across message handler threads by node id, so that
+     * one peer's messages are always processed in order by the same thread.
+     */
+    int nMessageHandlerThreads;
+
+    /** flags for waking each message handler thread, guarded by mutexMsgProc. */
+    std::vector<bool> vMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -428,7 +469,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -606,7 +647,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CPreparedNetMsgRef> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -658,6 +699,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Socket handler thread only: the socket may have unread data
+    bool fRecvReady;
+    // A message was processed without checking whether the peer is to be
+    // banned; its next SendMessages has to check even if cs_main is busy
+    std::atomic_bool fBanCheckPending;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -670,6 +716,8 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    // Protects vAddrToSend and addrKnown, which are also filled while processing other peers' messages
+    CCriticalSection cs_addrSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -792,6 +840,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -800,6 +849,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
@@ -824,6 +824,50 @@ static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_bloc
 static uint256 most_recent_block_hash;
 static bool fWitnessesPresentInMostRecentCompactBlock;
 
+/** Number of serialized block and compact block messages kept for relay */
+static const unsigned int MAX_BLOCK_MSG_CACHE_SIZE = 8;
+
+// Serialized block and compact block messages of blocks near the tip, by
+// block hash, message type and whether they include witness data, so that
+// a block announced to or requested by many peers is serialized once.
+// Protected by cs_block_msg_cache, most recently added first.
+struct CachedBlockMsg
+{
+    uint256 hash;
+    std::string command;
+    bool fWitness;
+    CPreparedNetMsgRef msg;
+};
+static CCriticalSection cs_block_msg_cache;
+static std::deque<CachedBlockMsg> block_msg_cache;
+
+/** Get a block message from the cache, or make it with make() and add it. */
+CPreparedNetMsgRef GetBlockMessage(const uint256& hash, const std::string& command, bool fWitness, const std::function<CSerializedNetMsg()>& make)
+{
+    {
+        LOCK(cs_block_msg_cache);
+        for (const CachedBlockMsg& cached : block_msg_cache) {
+            if (cached.hash == hash && cached.command == command && cached.fWitness == fWitness)
+                return cached.msg;
+        }
+    }
+    CPreparedNetMsgRef msg = CConnman::PrepareMessage(make());
+    LOCK(cs_block_msg_cache);
+    block_msg_cache.push_front(CachedBlockMsg{hash, command, fWitness, msg});
+    if (block_msg_cache.size() > MAX_BLOCK_MSG_CACHE_SIZE)
+        block_msg_cache.pop_back();
+    return msg;
+}
+
+/** Push a block message to pnode, through the block message cache if fCache. */
+static void PushBlockMessage(CConnman* connman, CNode* pnode, bool fCache, const uint256& hash, const std::string& command, bool fWitness, const std::function<CSerializedNetMsg()>& make)
+{
+    if (fCache)
+        connman->PushMessage(pnode, GetBlockMessage(hash, command, fWitness, make));
+    else
+        connman->PushMessage(pnode, make());
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
@@ -846,8 +890,10 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Serialized once, for the first peer it is announced to, and shared with
+    // the others and later getdata requests
+    CPreparedNetMsgRef msgCmpctBlock;
+    connman->ForEachNode([this, &pcmpctblock, &msgCmpctBlock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -859,7 +905,12 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (!msgCmpctBlock) {
+                msgCmpctBlock = GetBlockMessage(hashBlock, NetMsgType::CMPCTBLOCK, true, [&msgMaker, &pcmpctblock] {
+                    return msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock);
+                });
+            }
+            connman->PushMessage(pnode, msgCmpctBlock);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1090,17 +1141,22 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
                         pblock = a_recent_block;
                     } else {
-                        // Send block from disk
-                        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-                        if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
+                        // Send block from the block cache or disk
+                        pblock = ReadBlockFromDiskCached((*mi).second, consensusParams);
+                        if (!pblock)
                             assert(!"cannot load block from disk");
-                        pblock = pblockRead;
                     }
-                    if (inv.type == MSG_BLOCK)
-                        connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-                    else if (inv.type == MSG_FILTERED_BLOCK)
+                    // Blocks near the tip are likely requested by many peers
+                    const bool fCacheMsg = mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    if (inv.type == MSG_BLOCK) {
+                        PushBlockMessage(connman, pfrom, fCacheMsg, inv.hash, NetMsgType::BLOCK, false, [&msgMaker, &pblock] {
+                            return msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock);
+                        });
+                    } else if (inv.type == MSG_WITNESS_BLOCK) {
+                        PushBlockMessage(connman, pfrom, fCacheMsg, inv.hash, NetMsgType::BLOCK, true, [&msgMaker, &pblock] {
+                            return msgMaker.Make(NetMsgType::BLOCK, *pblock);
+                        });
+                    } else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
                         CMerkleBlock merkleBlock;
@@ -1135,14 +1191,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
                         int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                            } else {
+                            PushBlockMessage(connman, pfrom, true, inv.hash, NetMsgType::CMPCTBLOCK, fPeerWantsWitness, [&]() -> CSerializedNetMsg {
+                                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
+                                    return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block);
+                                }
                                 CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                            }
+                                return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
+                            });
                         } else {
-                            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
+                            PushBlockMessage(connman, pfrom, fCacheMsg, inv.hash, NetMsgType::BLOCK, fPeerWantsWitness, [&msgMaker, nSendFlags, &pblock] {
+                                return msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock);
+                            });
                         }
                     }
 
@@ -1157,6 +1216,10 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
                         pfrom->hashContinue.SetNull();
                     }
+                } else if (send && (mi->second->nStatus & BLOCK_ASSUMED_VALID)) {
+                    // Taken from a UTXO snapshot and never downloaded: say so,
+                    // so the peer asks someone else rather than timing out.
+                    vNotFound.push_back(inv);
                 }
             }
             else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
@@ -1989,11 +2052,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        CBlock block;
-        bool ret = ReadBlockFromDisk(block, it->second, chainparams.GetConsensus());
-        assert(ret);
+        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(it->second, chainparams.GetConsensus());
+        assert(pblock);
 
-        SendBlockTransactions(block, req, pfrom, connman);
+        SendBlockTransactions(*pblock, req, pfrom, connman);
     }
 
 
@@ -2464,7 +2526,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         BlockTransactions resp;
-        vRecv >> resp;
+        vRecv >> resp.blockhash;
+        DeserializeTransactionsParallel(vRecv, resp.txn);
 
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         bool fBlockRead = false;
@@ -2565,7 +2628,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        DeserializeBlockParallel(vRecv, *pblock);
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
 
@@ -2611,7 +2674,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -2803,6 +2869,22 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     return true;
 }
 
+/**
+ * Whether a message is handled without chain state. Such handlers take cs_main
+ * at most to score misbehavior, which the peer's next SendMessages acts upon,
+ * so processing them never has to wait for cs_main.
+ */
+static bool IsLightMessage(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::PING ||
+           strCommand == NetMsgType::PONG ||
+           strCommand == NetMsgType::ADDR ||
+           strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::FEEFILTER ||
+           strCommand == NetMsgType::FILTERCLEAR ||
+           strCommand == NetMsgType::NOTFOUND;
+}
+
 static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman* connman)
 {
     AssertLockHeld(cs_main);
@@ -2947,8 +3029,12 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->GetId());
     }
 
-    LOCK(cs_main);
-    SendRejectsAndCheckIfBanned(pfrom, connman);
+    if (!IsLightMessage(strCommand)) {
+        LOCK(cs_main);
+        SendRejectsAndCheckIfBanned(pfrom, connman);
+    } else {
+        pfrom->fBanCheckPending = true;
+    }
 
     return fMoreWork;
 }
@@ -3082,20 +3168,75 @@ void PeerLogicValidation::CheckForStaleTipAndEvictPeers(const Consensus::Params
     }
 }
 
-class CompareInvMempoolOrder
+/** How long the shared relay info of a transaction queued for announcement is kept, in microseconds */
+static const int64_t RELAY_TX_INFO_EXPIRY = 15 * 60 * 1000000;
+/** How often expired relay info is swept, in microseconds */
+static const int64_t RELAY_TX_INFO_SWEEP_INTERVAL = 60 * 1000000;
+
+namespace {
+    struct RelayTxInfo {
+        TxMempoolRelayInfo info;
+        int64_t nTimeAdded;
+    };
+
+    /**
+     * Relay info of transactions queued for announcement. Each transaction
+     * is looked up in the mempool once, and all peers' inventory trickles
+     * share the result. Ancestor counts change when the tip changes, so the
+     * entries are dropped then and looked up again on demand. Protected by
+     * cs_main.
+     */
+    std::unordered_map<uint256, RelayTxInfo, SaltedTxidHasher> mapRelayTxInfo;
+    /** The tip that mapRelayTxInfo was filled at, protected by cs_main. */
+    const CBlockIndex* pindexRelayTxInfo = nullptr;
+    /** When expired mapRelayTxInfo entries are swept next, protected by cs_main. */
+    int64_t nNextRelayTxInfoSweep = 0;
+} // namespace
+
+/** Make sure mapRelayTxInfo is current and covers every transaction in setTxToSend that is still in the mempool. */
+static void UpdateRelayTxInfo(const std::set<uint256>& setTxToSend, int64_t nNow) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    CTxMemPool *mp;
-public:
-    CompareInvMempoolOrder(CTxMemPool *_mempool)
-    {
-        mp = _mempool;
+    if (pindexRelayTxInfo != chainActive.Tip()) {
+        pindexRelayTxInfo = chainActive.Tip();
+        mapRelayTxInfo.clear();
+    } else if (nNextRelayTxInfoSweep <= nNow) {
+        for (auto it = mapRelayTxInfo.begin(); it != mapRelayTxInfo.end();) {
+            if (it->second.nTimeAdded + RELAY_TX_INFO_EXPIRY < nNow)
+                it = mapRelayTxInfo.erase(it);
+            else
+                ++it;
+        }
+        nNextRelayTxInfoSweep = nNow + RELAY_TX_INFO_SWEEP_INTERVAL;
+    }
+
+    std::vector<uint256> vMissing;
+    for (const uint256& hash : setTxToSend) {
+        if (!mapRelayTxInfo.count(hash))
+            vMissing.push_back(hash);
+    }
+    if (vMissing.empty())
+        return;
+    for (TxMempoolRelayInfo& info : mempool.relayInfo(vMissing)) {
+        const uint256 hash = info.tx->GetHash();
+        mapRelayTxInfo.emplace(hash, RelayTxInfo{std::move(info), nNow});
     }
+}
 
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
+class CompareInvRelayOrder
+{
+public:
+    bool operator()(const RelayTxInfo* a, const RelayTxInfo* b) const
     {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+         * fewest ancestors/highest fee to sort later, as in
+         * CTxMemPool::CompareDepthAndScore. */
+        if (a->info.nCountWithAncestors != b->info.nCountWithAncestors)
+            return a->info.nCountWithAncestors > b->info.nCountWithAncestors;
+        double f1 = (double)a->info.nModFee * b->info.nTxSize;
+        double f2 = (double)b->info.nModFee * a->info.nTxSize;
+        if (f1 == f2)
+            return a->info.tx->GetHash() < b->info.tx->GetHash();
+        return f1 < f2;
     }
 };
 
@@ -3140,9 +3281,18 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         }
 
         TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
-        if (!lockMain)
+        if (!lockMain) {
+            // The rest can wait for the next round, but a light message
+            // may have made the peer misbehave since it was last checked.
+            if (pto->fBanCheckPending) {
+                LOCK(cs_main);
+                pto->fBanCheckPending = false;
+                SendRejectsAndCheckIfBanned(pto, connman);
+            }
             return true;
+        }
 
+        pto->fBanCheckPending = false;
         if (SendRejectsAndCheckIfBanned(pto, connman))
             return true;
         CNodeState &state = *State(pto->GetId());
@@ -3159,6 +3309,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -3292,26 +3443,21 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
                     int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
 
-                    bool fGotBlockFromCache = false;
-                    {
-                        LOCK(cs_most_recent_block);
-                        if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
-                            else {
+                    connman->PushMessage(pto, GetBlockMessage(pBestIndex->GetBlockHash(), NetMsgType::CMPCTBLOCK, state.fWantsCmpctWitness, [&]() -> CSerializedNetMsg {
+                        {
+                            LOCK(cs_most_recent_block);
+                            if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
+                                if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
+                                    return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block);
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                                return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
                             }
-                            fGotBlockFromCache = true;
                         }
-                    }
-                    if (!fGotBlockFromCache) {
-                        CBlock block;
-                        bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
-                        assert(ret);
-                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
-                        connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                    }
+                        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pBestIndex, consensusParams);
+                        assert(pblock);
+                        CBlockHeaderAndShortTxIDs cmpctblock(*pblock, state.fWantsCmpctWitness);
+                        return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
+                    }));
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
@@ -3424,46 +3570,47 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
+                UpdateRelayTxInfo(pto->setInventoryTxToSend, nNow);
+                // Produce a vector with all candidates for sending, dropping the ones
+                // that are known to the peer, not in the mempool or below its fee filter
+                std::vector<const RelayTxInfo*> vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                LOCK(pto->cs_filter);
+                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end();) {
+                    auto mi = mapRelayTxInfo.find(*it);
+                    if (mi == mapRelayTxInfo.end() || pto->filterInventoryKnown.contains(*it) ||
+                        (filterrate && mi->second.info.feeRate.GetFeePerK() < filterrate)) {
+                        it = pto->setInventoryTxToSend.erase(it);
+                        continue;
+                    }
+                    vInvTx.push_back(&mi->second);
+                    it++;
+                }
                 // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                 // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                CompareInvRelayOrder compareInvRelayOrder;
+                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvRelayOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
-                LOCK(pto->cs_filter);
                 while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                     // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
+                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvRelayOrder);
+                    const CTransactionRef& tx = vInvTx.back()->info.tx;
                     vInvTx.pop_back();
-                    uint256 hash = *it;
+                    const uint256& hash = tx->GetHash();
                     // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
+                    pto->setInventoryTxToSend.erase(hash);
                     // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
-                    }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
+                    if (!mempool.exists(hash)) {
                         continue;
                     }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*tx)) continue;
                     // Send
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
@@ -3475,7 +3622,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, tx));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
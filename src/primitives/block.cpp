@@ -23,6 +23,16 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+void GetPoWHashes(const CBlockHeader* headers, size_t count, uint256* hashes)
+{
+    if (count == 0)
+        return;
+    std::vector<char> input(80 * count);
+    for (size_t i = 0; i < count; i++)
+        memcpy(&input[80 * i], BEGIN(headers[i].nVersion), 80);
+    scrypt_1024_1_1_256_multi(input.data(), BEGIN(hashes[0]), count);
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -71,6 +71,10 @@ public:
 };
 
 
+/** Compute the proof-of-work hashes of count headers at once, using the multi-lane scrypt kernel. */
+void GetPoWHashes(const CBlockHeader* headers, size_t count, uint256* hashes);
+
+
 class CBlock : public CBlockHeader
 {
 public:
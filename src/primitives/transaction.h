@@ -286,8 +286,10 @@ public:
 private:
     /** Memory only. */
     const uint256 hash;
+    const uint256 m_witness_hash;
 
     uint256 ComputeHash() const;
+    uint256 ComputeWitnessHash() const;
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -315,8 +317,10 @@ public:
         return hash;
     }
 
-    // Compute a hash that includes both transaction and witness data
-    uint256 GetWitnessHash() const;
+    // Hash that includes both transaction and witness data, computed once at construction
+    const uint256& GetWitnessHash() const {
+        return m_witness_hash;
+    }
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
@@ -208,7 +208,7 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    std::shared_ptr<const CBlock> pblock;
     CBlockIndex* pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -219,9 +219,11 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        pblock = ReadBlockFromDiskCached(pblockindex, Params().GetConsensus());
+        if (!pblock)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
+    const CBlock& block = *pblock;
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
     ssBlock << block;
@@ -511,12 +513,14 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         if (fCheckMemPool)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
+        // Look all outpoints up at once, which lets the database visit them in key order.
+        std::vector<Coin> vCoins(vOutPoints.size());
+        view.GetCoins(vOutPoints.data(), vCoins.data(), vOutPoints.size());
         for (size_t i = 0; i < vOutPoints.size(); i++) {
             bool hit = false;
-            Coin coin;
-            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+            if (!vCoins[i].IsSpent() && !mempool.isSpent(vOutPoints[i])) {
                 hit = true;
-                outs.emplace_back(std::move(coin));
+                outs.emplace_back(std::move(vCoins[i]));
             }
 
             hits.push_back(hit);
@@ -10,6 +10,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "validation.h"
 #include "core_io.h"
@@ -751,19 +752,20 @@ UniValue getblock(const JSONRPCRequest& request)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex, Params().GetConsensus());
+    if (!pblock)
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
         // non-whitelisted node sends us an unrequested long chain of valid
         // blocks, we add the headers to our index, but don't accept the
         // block).
         throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+    const CBlock& block = *pblock;
 
     if (verbosity <= 0)
     {
@@ -776,76 +778,6 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -897,29 +829,57 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is \"muhash\".\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"hash_serialized_2\") Which UTXO set hash to return:\n"
+            "                 \"hash_serialized_2\" scans the whole set and returns all statistics,\n"
+            "                 \"muhash\" returns the rolling hash the node maintains, without a scan\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
-            "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized_2 only)\n"
+            "  \"txouts\": n,            (numeric) The number of output transactions (hash_serialized_2 only)\n"
+            "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size (hash_serialized_2 only)\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (hash_serialized_2 only)\n"
+            "  \"muhash\": \"hash\",     (string) The rolling MuHash of the set (muhash only)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"total_amount\": x.xxx          (numeric) The total amount (hash_serialized_2 only)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    std::string hash_type = "hash_serialized_2";
+    if (!request.params[0].isNull())
+        hash_type = request.params[0].get_str();
+
     UniValue ret(UniValue::VOBJ);
 
+    if (hash_type == "muhash") {
+        LOCK(cs_main);
+        MuHash3072 hash;
+        if (!pcoinsTip->GetUTXOSetHash(hash))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set hash is not available");
+        unsigned char digest[32];
+        hash.Finalize(digest);
+        const uint256 hashBlock = pcoinsTip->GetBestBlock();
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        ret.push_back(Pair("height", it == mapBlockIndex.end() ? -1 : (int64_t)it->second->nHeight));
+        ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+        ret.push_back(Pair("muhash", uint256(std::vector<unsigned char>(digest, digest + sizeof(digest))).GetHex()));
+        ret.push_back(Pair("disk_size", (uint64_t)pcoinsdbview->EstimateSize()));
+        return ret;
+    }
+    if (hash_type != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type: " + hash_type);
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview, stats)) {
@@ -937,6 +897,97 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at " + std::to_string(TXOUTSET_SNAPSHOT_DEPTH) + " blocks below the current tip to a snapshot file,\n"
+            "which a new node can start from with -loadtxoutset and -loadtxoutsethash=<base_hash>:<hash_serialized_2>.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The file to write; relative paths are taken relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,         (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hex\",         (string) The hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n,           (numeric) The height of that block\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the set, as reported by gettxoutsetinfo\n"
+            "  \"path\": \"path\"              (string) The absolute path of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    CCoinsStats stats;
+    std::string strError;
+    if (!DumpTxOutSet(path, stats, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write UTXO snapshot: " + strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("base_hash", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    const CDBOptions& dboptions = db.GetDBOptions();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("max_open_files", dboptions.nMaxOpenFiles));
+    ret.push_back(Pair("block_size", (uint64_t)dboptions.nBlockSize));
+    ret.push_back(Pair("compression", dboptions.fCompression));
+    ret.push_back(Pair("bloom_bits", dboptions.nBloomBits));
+    std::string value;
+    if (db.GetProperty("leveldb.approximate-memory-usage", value))
+        ret.push_back(Pair("approximate_memory_usage", atoi64(value)));
+    if (db.GetProperty("leveldb.stats", value))
+        ret.push_back(Pair("stats", value));
+    return ret;
+}
+
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdbstats\n"
+            "\nReturns the settings and LevelDB statistics of the chainstate and block index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {              (json object) The chainstate database\n"
+            "    \"max_open_files\": n,          (numeric) Maximum number of files LevelDB keeps open\n"
+            "    \"block_size\": n,              (numeric) Block size in bytes\n"
+            "    \"compression\": true|false,    (boolean) Whether blocks are compressed with Snappy\n"
+            "    \"bloom_bits\": n,              (numeric) Bloom filter bits per key, 0 if disabled\n"
+            "    \"approximate_memory_usage\": n,  (numeric) Memory used by LevelDB's memtables and caches, in bytes\n"
+            "    \"stats\": \"str\"               (string) The leveldb.stats report: files and sizes per level, and compaction totals\n"
+            "  },\n"
+            "  \"index\": { ... }               (json object) The block index database, with the same fields\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview)
+        ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    if (pblocktree)
+        ret.push_back(Pair("index", DBStatsToJSON(*pblocktree)));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1354,6 +1405,38 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getindexpowinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getindexpowinfo\n"
+            "\nReturns the progress of the background block index proof-of-work check enabled with -verifyindexpow.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"started\": xxxx,          (boolean) Whether the check was started\n"
+            "  \"done\": xxxx,             (boolean) Whether every entry was checked and passed\n"
+            "  \"total\": xxxxx,           (numeric) Number of block index entries to check\n"
+            "  \"checked\": xxxxx,         (numeric) Number of entries checked so far\n"
+            "  \"progress\": xxxxx,        (numeric) Estimate of check progress [0..1]\n"
+            "  \"failedhash\": \"hash\"     (string, optional) The entry whose proof of work failed, if any\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexpowinfo", "")
+            + HelpExampleRpc("getindexpowinfo", "")
+        );
+
+    const IndexPoWVerifyStatus status = GetIndexPoWVerifyStatus();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("started", status.fStarted));
+    ret.push_back(Pair("done", status.fDone));
+    ret.push_back(Pair("total", (uint64_t)status.nTotal));
+    ret.push_back(Pair("checked", (uint64_t)status.nChecked));
+    ret.push_back(Pair("progress", status.nTotal ? (double)status.nChecked / status.nTotal : (status.fDone ? 1.0 : 0.0)));
+    if (!status.hashFailed.IsNull())
+        ret.push_back(Pair("failedhash", status.hashFailed.GetHex()));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1535,6 +1618,7 @@ UniValue getchaintxstats(const JSONRPCRequest& request)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafe argNames
   //  --------------------- ------------------------  -----------------------  ------ ----------
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  {"path"} },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        true,  {"nblocks", "blockhash"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
@@ -1543,14 +1627,16 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
+    { "blockchain",         "getindexpowinfo",        &getindexpowinfo,        true,  {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"hash_type"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
@@ -108,6 +108,10 @@ UniValue getnetworkhashps(const JSONRPCRequest& request)
 UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
 {
     static const int nInnerLoopCount = 0x10000;
+    int nThreads = gArgs.GetArg("-genthreads", DEFAULT_GENERATE_THREADS);
+    if (nThreads < 0)
+        nThreads = GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_GENERATE_THREADS));
     int nHeightEnd = 0;
     int nHeight = 0;
 
@@ -128,16 +132,17 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
-        if (nMaxTries == 0) {
-            break;
-        }
-        if (pblock->nNonce == nInnerLoopCount) {
+        const uint32_t nLimit = std::min<uint64_t>(nInnerLoopCount, nMaxTries);
+        const uint32_t nTried = GrindBlockNonce(pblock, nLimit, nThreads, Params().GetConsensus());
+        if (pblock->nNonce == nLimit) {
+            nMaxTries -= nTried;
+            if (nMaxTries == 0) {
+                break;
+            }
             continue;
         }
+        // The winning nonce itself is not charged, matching the serial loop.
+        nMaxTries -= nTried - 1;
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
         if (!ProcessNewBlock(Params(), shared_pblock, true, nullptr))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
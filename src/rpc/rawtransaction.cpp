@@ -235,9 +235,10 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
         pblockindex = mapBlockIndex[hashBlock];
     }
 
-    CBlock block;
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex, Params().GetConsensus());
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     unsigned int ntxFound = 0;
     for (const auto& tx : block.vtx)
@@ -138,6 +138,49 @@ private:
     size_t nPos;
 };
 
+/** Minimal read-only stream over a byte range that is owned elsewhere, such as
+ *  part of a larger buffer or a memory-mapped file. Nothing is copied up front.
+ */
+class CByteRangeReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+    const int nType;
+    const int nVersion;
+
+public:
+    CByteRangeReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    template<typename T>
+    CByteRangeReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CByteRangeReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(uint64_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CByteRangeReader::ignore(): end of data");
+        pcur += nSize;
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t size() const { return pend - pcur; }
+    const char* data() const { return pcur; }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
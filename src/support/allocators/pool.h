@@ -0,0 +1,194 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef herbsters_SUPPORT_ALLOCATORS_POOL_H
+#define herbsters_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <assert.h>
+#include <cstddef>
+#include <list>
+#include <new>
+#include <stdint.h>
+
+/**
+ * A memory resource that hands out small, equally aligned blocks carved from
+ * large chunks, and keeps freed blocks in one free list per size class.
+ *
+ * It is meant for node based containers such as std::unordered_map, where
+ * every element is a separate allocation of the same size: instead of one
+ * malloc per node (with its bookkeeping overhead and scattered placement),
+ * nodes are packed back to back into chunks and recycled on free.
+ *
+ * Requests larger than MAX_BLOCK_SIZE_BYTES, or with a stricter alignment than
+ * ALIGN_BYTES (e.g. the bucket array of a hash map), are passed on to
+ * ::operator new. Chunks are only returned to the system when the resource is
+ * destroyed.
+ *
+ * Not thread safe; the owner of the container has to synchronize access.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0, "ALIGN_BYTES must be nonzero");
+    static_assert((ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert((MAX_BLOCK_SIZE_BYTES & (ALIGN_BYTES - 1)) == 0, "MAX_BLOCK_SIZE_BYTES must be a multiple of ALIGN_BYTES");
+
+    /** In-place linked list of the freed blocks of one size class. */
+    struct ListNode
+    {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+
+    /** Every block is a multiple of this, and can hold a ListNode when freed. */
+    static const std::size_t ELEM_ALIGN_BYTES = alignof(ListNode) > ALIGN_BYTES ? alignof(ListNode) : ALIGN_BYTES;
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "::operator new does not provide the block alignment");
+
+    const std::size_t m_chunk_size_bytes;
+    std::list<char*> m_allocated_chunks;
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+    char* m_available_memory_it;
+    char* m_available_memory_end;
+
+    /** Number of ELEM_ALIGN_BYTES units used for a block of this size (at least one). */
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode(node);
+    }
+
+    /** Put the unused tail of the current chunk into a free list and start a new chunk. */
+    void AllocateChunk()
+    {
+        const std::size_t remaining_available_bytes = m_available_memory_end - m_available_memory_it;
+        if (remaining_available_bytes != 0) {
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_available_bytes / ELEM_ALIGN_BYTES]);
+        }
+        m_available_memory_it = static_cast<char*>(::operator new(m_chunk_size_bytes));
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_allocated_chunks.push_back(m_available_memory_it);
+    }
+
+public:
+    explicit PoolResource(std::size_t chunk_size_bytes) :
+        m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES),
+        m_available_memory_it(nullptr), m_available_memory_end(nullptr)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+        AllocateChunk();
+    }
+
+    /** Chunks of 256 KiB, which keeps the per-chunk overhead negligible. */
+    PoolResource() : PoolResource(1 << 18) {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (char* chunk : m_allocated_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            ListNode*& free_list = m_free_lists[num_alignments];
+            if (free_list != nullptr) {
+                // Reuse a freed block of the same size class.
+                ListNode* node = free_list;
+                free_list = node->m_next;
+                return node;
+            }
+            const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+            if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+                AllocateChunk();
+            }
+            void* p = m_available_memory_it;
+            m_available_memory_it += round_bytes;
+            return p;
+        }
+        return ::operator new(bytes);
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            PlacementAddToList(p, m_free_lists[NumElemAlignBytes(bytes)]);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+/**
+ * Allocator that takes its memory from a PoolResource. Copies and rebinds
+ * share the resource, which has to outlive every container using it.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+    PoolAllocator(const PoolAllocator& other) noexcept = default;
+    PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // herbsters_SUPPORT_ALLOCATORS_POOL_H
@@ -5,9 +5,11 @@
 // Unit tests for denial-of-service detection/prevention code
 
 #include "chainparams.h"
+#include "consensus/merkle.h"
 #include "keystore.h"
 #include "net.h"
 #include "net_processing.h"
+#include "netmessagemaker.h"
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
@@ -17,6 +19,7 @@
 #include "test/test_herbsters.h"
 
 #include <stdint.h>
+#include <thread>
 
 #include <boost/test/unit_test.hpp>
 
@@ -30,6 +33,7 @@ struct COrphanTx {
     int64_t nTimeExpire;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern CPreparedNetMsgRef GetBlockMessage(const uint256& hash, const std::string& command, bool fWitness, const std::function<CSerializedNetMsg()>& make);
 
 CService ip(uint32_t i)
 {
@@ -263,6 +267,103 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     peerLogic->FinalizeNode(dummyNode.GetId(), dummy);
 }
 
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(DoS_banning_light_message)
+{
+    std::atomic<bool> interruptDummy(false);
+
+    connman->ClearBanned();
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CAddress addr(ip(0xa0b0c001), NODE_NONE);
+    CNode dummyNode(id++, NODE_NETWORK, 0, fds[0], addr, 5, 5, CAddress(), "", true);
+    dummyNode.SetSendVersion(PROTOCOL_VERSION);
+    dummyNode.SetRecvVersion(PROTOCOL_VERSION);
+    peerLogic->InitializeNode(&dummyNode);
+    dummyNode.nVersion = PROTOCOL_VERSION;
+    dummyNode.fSuccessfullyConnected = true;
+    Misbehaving(dummyNode.GetId(), 80);
+
+    // An oversized addr message, which is processed without cs_main, makes
+    // up the rest of the ban score
+    std::vector<CAddress> vAddr(1001, CAddress(ip(0xa0b0c002), NODE_NETWORK));
+    CPreparedNetMsgRef pmsg = CConnman::PrepareMessage(CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::ADDR, vAddr));
+    std::vector<unsigned char> bytes(pmsg->header);
+    bytes.insert(bytes.end(), pmsg->data.begin(), pmsg->data.end());
+    BOOST_REQUIRE_EQUAL(send(fds[1], bytes.data(), bytes.size(), 0), (ssize_t)bytes.size());
+    CConnmanTest::SocketRecvData(*connman, dummyNode);
+    {
+        LOCK(dummyNode.cs_vProcessMsg);
+        BOOST_REQUIRE_EQUAL(dummyNode.vProcessMsg.size(), 1U);
+    }
+    peerLogic->ProcessMessages(&dummyNode, interruptDummy);
+    BOOST_CHECK(!connman->IsBanned(addr)); // not checked after a light message...
+    peerLogic->SendMessages(&dummyNode, interruptDummy);
+    BOOST_CHECK(connman->IsBanned(addr));  // ... but before anything is sent to the peer
+    BOOST_CHECK(dummyNode.fDisconnect);
+
+    bool dummy;
+    peerLogic->FinalizeNode(dummyNode.GetId(), dummy);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_banning_light_message_shards)
+{
+    std::atomic<bool> interruptDummy(false);
+
+    connman->ClearBanned();
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CAddress addr(ip(0xa0b0c003), NODE_NONE);
+    CNode dummyNode(id++, NODE_NETWORK, 0, fds[0], addr, 6, 6, CAddress(), "", true);
+    dummyNode.SetSendVersion(PROTOCOL_VERSION);
+    dummyNode.SetRecvVersion(PROTOCOL_VERSION);
+    peerLogic->InitializeNode(&dummyNode);
+    dummyNode.nVersion = PROTOCOL_VERSION;
+    dummyNode.fSuccessfullyConnected = true;
+    Misbehaving(dummyNode.GetId(), 80);
+
+    // Only a light message makes up the rest of the ban score
+    std::vector<CAddress> vAddr(1001, CAddress(ip(0xa0b0c004), NODE_NETWORK));
+    CPreparedNetMsgRef pmsg = CConnman::PrepareMessage(CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::ADDR, vAddr));
+    std::vector<unsigned char> bytes(pmsg->header);
+    bytes.insert(bytes.end(), pmsg->data.begin(), pmsg->data.end());
+    BOOST_REQUIRE_EQUAL(send(fds[1], bytes.data(), bytes.size(), 0), (ssize_t)bytes.size());
+    CConnmanTest::SocketRecvData(*connman, dummyNode);
+    peerLogic->ProcessMessages(&dummyNode, interruptDummy);
+    BOOST_CHECK(!dummyNode.fDisconnect);
+
+    // Two other threads keep cs_main busy: one of them is always waiting for
+    // it, so the handlers' SendMessages practically never try-lock it.
+    std::atomic<bool> fStop(false);
+    std::vector<std::thread> vThreadsBusy;
+    for (int i = 0; i < 2; i++) {
+        vThreadsBusy.emplace_back([&fStop] {
+            while (!fStop) {
+                LOCK(cs_main);
+                MilliSleep(5);
+            }
+        });
+    }
+    CConnmanTest::AddNode(*connman, dummyNode);
+    CConnmanTest::StartMessageHandlers(*connman, peerLogic.get(), 3);
+    for (int i = 0; i < 300 && !dummyNode.fDisconnect; i++)
+        MilliSleep(10);
+
+    fStop = true;
+    for (std::thread& thread : vThreadsBusy)
+        thread.join();
+    CConnmanTest::StopMessageHandlers(*connman);
+    CConnmanTest::ClearNodes(*connman);
+    BOOST_CHECK(dummyNode.fDisconnect);
+    BOOST_CHECK(connman->IsBanned(addr));
+
+    bool dummy;
+    peerLogic->FinalizeNode(dummyNode.GetId(), dummy);
+    close(fds[1]);
+}
+#endif
+
 CTransactionRef RandomOrphan()
 {
     std::map<uint256, COrphanTx>::iterator it;
@@ -352,4 +453,64 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+BOOST_AUTO_TEST_CASE(block_msg_cache)
+{
+    // A block with witness data, so that its witness and non-witness
+    // serializations differ
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_1;
+    coinbase.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    const uint256 hash = block.GetHash();
+
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    int nMade = 0;
+    auto makeWitness = [&] { nMade++; return msgMaker.Make(NetMsgType::BLOCK, block); };
+    auto makeNoWitness = [&] { nMade++; return msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block); };
+    CPreparedNetMsgRef freshWitness = CConnman::PrepareMessage(msgMaker.Make(NetMsgType::BLOCK, block));
+    CPreparedNetMsgRef freshNoWitness = CConnman::PrepareMessage(msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
+    BOOST_REQUIRE(freshWitness->data != freshNoWitness->data);
+
+    // A cache hit returns the message made on the miss, byte for byte the
+    // same as a fresh serialization
+    CPreparedNetMsgRef msgWitness = GetBlockMessage(hash, NetMsgType::BLOCK, true, makeWitness);
+    BOOST_CHECK_EQUAL(nMade, 1);
+    BOOST_CHECK(GetBlockMessage(hash, NetMsgType::BLOCK, true, makeWitness) == msgWitness);
+    BOOST_CHECK_EQUAL(nMade, 1);
+    BOOST_CHECK_EQUAL(msgWitness->command, NetMsgType::BLOCK);
+    BOOST_CHECK(msgWitness->header == freshWitness->header);
+    BOOST_CHECK(msgWitness->data == freshWitness->data);
+
+    // Witness and non-witness messages of the same block are cached apart
+    CPreparedNetMsgRef msgNoWitness = GetBlockMessage(hash, NetMsgType::BLOCK, false, makeNoWitness);
+    BOOST_CHECK_EQUAL(nMade, 2);
+    BOOST_CHECK(msgNoWitness != msgWitness);
+    BOOST_CHECK(msgNoWitness->header == freshNoWitness->header);
+    BOOST_CHECK(msgNoWitness->data == freshNoWitness->data);
+    BOOST_CHECK(GetBlockMessage(hash, NetMsgType::BLOCK, false, makeNoWitness) == msgNoWitness);
+    BOOST_CHECK(GetBlockMessage(hash, NetMsgType::BLOCK, true, makeWitness) == msgWitness);
+    BOOST_CHECK_EQUAL(nMade, 2);
+
+    // The cache holds the 8 most recently added messages: with six more it
+    // is full and still holds both, the next one evicts the oldest
+    for (int i = 0; i < 6; i++)
+        GetBlockMessage(InsecureRand256(), NetMsgType::BLOCK, true, makeWitness);
+    BOOST_CHECK_EQUAL(nMade, 8);
+    BOOST_CHECK(GetBlockMessage(hash, NetMsgType::BLOCK, true, makeWitness) == msgWitness);
+    BOOST_CHECK_EQUAL(nMade, 8);
+    GetBlockMessage(InsecureRand256(), NetMsgType::BLOCK, true, makeWitness);
+    BOOST_CHECK_EQUAL(nMade, 9);
+    BOOST_CHECK(GetBlockMessage(hash, NetMsgType::BLOCK, false, makeNoWitness) == msgNoWitness);
+    BOOST_CHECK_EQUAL(nMade, 9);
+    CPreparedNetMsgRef msgAgain = GetBlockMessage(hash, NetMsgType::BLOCK, true, makeWitness);
+    BOOST_CHECK_EQUAL(nMade, 10);
+    BOOST_CHECK(msgAgain != msgWitness);
+    BOOST_CHECK(msgAgain->data == freshWitness->data);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
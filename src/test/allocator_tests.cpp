@@ -4,9 +4,13 @@
 
 #include "util.h"
 
+#include "memusage.h"
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_herbsters.h"
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +235,61 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+
+    // Blocks of one size class are carved consecutively from the chunk
+    char* a = static_cast<char*>(resource.Allocate(24, 8));
+    char* b = static_cast<char*>(resource.Allocate(20, 8));
+    BOOST_CHECK(b == a + 24);
+
+    // A freed block is handed out again for the same size class only
+    resource.Deallocate(a, 24, 8);
+    char* c = static_cast<char*>(resource.Allocate(16, 8));
+    BOOST_CHECK(c == b + 24);
+    BOOST_CHECK(resource.Allocate(24, 8) == a);
+
+    // Large or overaligned requests bypass the pool
+    void* big = resource.Allocate(65, 8);
+    void* aligned = resource.Allocate(8, 16);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 8, 16);
+
+    // Running out of space starts a new chunk
+    for (int i = 0; i < 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 5U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map_tests)
+{
+    typedef std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                               PoolAllocator<std::pair<const uint64_t, uint64_t>, 64> > Map;
+    Map::allocator_type::ResourceType resource;
+    {
+        Map map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource);
+        for (uint64_t i = 0; i < 10000; i++)
+            map[i] = i * i;
+        for (uint64_t i = 0; i < 10000; i += 2)
+            map.erase(i);
+        BOOST_CHECK_EQUAL(map.size(), 5000U);
+        BOOST_CHECK_EQUAL(map[9999], 9999U * 9999U);
+
+        // Erased nodes are reused, so refilling does not grow the pool
+        const size_t nChunks = resource.NumAllocatedChunks();
+        for (uint64_t i = 0; i < 10000; i += 2)
+            map[i] = i;
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+
+        // Memory usage is accounted as whole chunks plus the bucket array
+        const size_t usage = memusage::DynamicUsage(map);
+        BOOST_CHECK(usage >= resource.NumAllocatedChunks() * resource.ChunkSizeBytes());
+        BOOST_CHECK(usage < (resource.NumAllocatedChunks() + 1) * resource.ChunkSizeBytes() + memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,61 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "primitives/transaction.h"
+#include "test/test_herbsters.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+static std::shared_ptr<const CBlock> MakeBlock(uint32_t nNonce)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->nNonce = nNonce;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nNonce;
+    pblock->vtx.push_back(MakeTransactionRef(std::move(tx)));
+    return pblock;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    std::shared_ptr<const CBlock> pblock1 = MakeBlock(1);
+    std::shared_ptr<const CBlock> pblock2 = MakeBlock(2);
+    std::shared_ptr<const CBlock> pblock3 = MakeBlock(3);
+
+    CBlockCache cache;
+    cache.Insert(pblock1->GetHash(), pblock1);
+    BOOST_CHECK(!cache.Get(pblock1->GetHash())); // disabled
+    BOOST_CHECK_EQUAL(cache.Usage(), 0U);
+
+    cache.SetMaxUsage(1 << 20);
+    cache.Insert(pblock1->GetHash(), pblock1);
+    cache.Insert(pblock1->GetHash(), pblock1);
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+    const size_t nUsage = cache.Usage();
+    BOOST_CHECK(nUsage > 0);
+    BOOST_CHECK(cache.Get(pblock1->GetHash()) == pblock1);
+
+    // Room for two blocks of this size: the least recently used one goes.
+    cache.SetMaxUsage(nUsage * 2);
+    cache.Insert(pblock2->GetHash(), pblock2);
+    BOOST_CHECK(cache.Get(pblock1->GetHash()) == pblock1);
+    cache.Insert(pblock3->GetHash(), pblock3);
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+    BOOST_CHECK(cache.Get(pblock1->GetHash()) == pblock1);
+    BOOST_CHECK(!cache.Get(pblock2->GetHash()));
+    BOOST_CHECK(cache.Get(pblock3->GetHash()) == pblock3);
+    BOOST_CHECK_EQUAL(cache.Usage(), nUsage * 2);
+
+    cache.SetMaxUsage(0);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK_EQUAL(cache.Usage(), 0U);
+    BOOST_CHECK(!cache.Get(pblock1->GetHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
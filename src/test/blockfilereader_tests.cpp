@@ -0,0 +1,70 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+#include "test/test_herbsters.h"
+
+#include <string.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilereader_tests, BasicTestingSetup)
+
+#ifndef WIN32
+static void AppendToFile(const fs::path& path, const std::string& data)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_map)
+{
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    const fs::path path1 = dir / "blk00000.dat";
+    const fs::path path2 = dir / "blk00001.dat";
+    const fs::path path3 = dir / "blk00002.dat";
+    AppendToFile(path1, "first");
+    AppendToFile(path2, "second");
+    AppendToFile(path3, "third");
+
+    CBlockFileReader reader;
+    BOOST_CHECK(!reader.Map(path1, 0)); // disabled
+    reader.SetMaxMappings(2);
+
+    std::shared_ptr<const CBlockFileMapping> mapping = reader.Map(path1, 5);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(std::string((const char*)mapping->data(), mapping->size()), "first");
+    BOOST_CHECK(reader.Map(path1, 3) == mapping);
+    BOOST_CHECK(!reader.Map(path1, 6));
+    BOOST_CHECK(!reader.Map(dir / "missing.dat", 0));
+
+    // A file that grew is mapped again; the old mapping stays readable.
+    AppendToFile(path1, " block");
+    std::shared_ptr<const CBlockFileMapping> grown = reader.Map(path1, 11);
+    BOOST_REQUIRE(grown);
+    BOOST_CHECK(grown != mapping);
+    BOOST_CHECK_EQUAL(std::string((const char*)grown->data(), grown->size()), "first block");
+    BOOST_CHECK_EQUAL(std::string((const char*)mapping->data(), mapping->size()), "first");
+
+    // The least recently used mapping is evicted.
+    std::shared_ptr<const CBlockFileMapping> second = reader.Map(path2, 0);
+    BOOST_REQUIRE(second);
+    BOOST_CHECK(reader.Map(path1, 0) == grown);
+    BOOST_CHECK(reader.Map(path3, 0));
+    BOOST_CHECK(reader.Map(path1, 0) == grown);
+    BOOST_CHECK(reader.Map(path2, 0) != second);
+
+    reader.Invalidate(path1);
+    BOOST_CHECK(reader.Map(path1, 0) != grown);
+    BOOST_CHECK_EQUAL(memcmp(grown->data(), "first block", 11), 0);
+
+    reader.Clear();
+    fs::remove_all(dir);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
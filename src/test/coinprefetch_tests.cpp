@@ -0,0 +1,119 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "primitives/block.h"
+#include "test/test_herbsters.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include <deque>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+// Tests these internal-to-validation.cpp functions:
+extern std::deque<std::pair<const CBlockIndex*, std::shared_ptr<const CBlock>>> g_read_ahead_blocks;
+extern void PrefetchBlockInputs(const CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const Consensus::Params& consensusParams);
+extern std::shared_ptr<const CBlock> TakeReadAheadBlock(const CBlockIndex* pindex);
+
+BOOST_FIXTURE_TEST_SUITE(coinprefetch_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(prefetch_block_inputs)
+{
+    // Start from a cache that has to read everything from the coins database
+    BOOST_REQUIRE(pcoinsTip->Flush());
+    BOOST_REQUIRE(pcoinsdbview->Sync());
+
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(2);
+    txSpend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    txSpend.vin[1].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = coinbaseTxns[0].vout[0].nValue;
+    txSpend.vout[0].scriptPubKey = coinbaseTxns[0].vout[0].scriptPubKey;
+    // Spends an output created in the same block, which is not in the database
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txSpend.GetHash(), 0);
+    txChild.vout = txSpend.vout;
+    // Spends an output that never existed
+    CMutableTransaction txMissing;
+    txMissing.vin.resize(1);
+    txMissing.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    txMissing.vout = txSpend.vout;
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->vtx.push_back(MakeTransactionRef(coinbaseTxns[2]));
+    pblock->vtx.push_back(MakeTransactionRef(txSpend));
+    pblock->vtx.push_back(MakeTransactionRef(txChild));
+    pblock->vtx.push_back(MakeTransactionRef(txMissing));
+
+    LOCK(cs_main);
+    for (const auto& tx : pblock->vtx) {
+        for (const CTxIn& txin : tx->vin)
+            BOOST_CHECK(!pcoinsTip->HaveCoinInCache(txin.prevout));
+    }
+
+    PrefetchBlockInputs(chainActive.Tip(), pblock, Params().GetConsensus());
+
+    for (int i = 0; i < 2; i++) {
+        const COutPoint& prevout = txSpend.vin[i].prevout;
+        BOOST_CHECK(pcoinsTip->HaveCoinInCache(prevout));
+        const Coin& coin = pcoinsTip->AccessCoin(prevout);
+        BOOST_CHECK(coin.out == coinbaseTxns[i].vout[0]);
+        BOOST_CHECK(coin.fCoinBase);
+        BOOST_CHECK_EQUAL((int)coin.nHeight, chainActive[i + 1]->nHeight);
+    }
+    BOOST_CHECK(!pcoinsTip->HaveCoinInCache(txChild.vin[0].prevout));
+    BOOST_CHECK(!pcoinsTip->HaveCoinInCache(txMissing.vin[0].prevout));
+    BOOST_CHECK(!pcoinsTip->HaveCoinInCache(COutPoint(coinbaseTxns[2].GetHash(), 0)));
+}
+
+BOOST_AUTO_TEST_CASE(take_read_ahead_block)
+{
+    LOCK(cs_main);
+    std::vector<std::shared_ptr<const CBlock>> vBlocks;
+    for (int nHeight = 50; nHeight < 53; nHeight++) {
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        BOOST_REQUIRE(ReadBlockFromDisk(*pblock, chainActive[nHeight], Params().GetConsensus()));
+        vBlocks.push_back(pblock);
+    }
+    auto readAhead = [&vBlocks] {
+        g_read_ahead_blocks.clear();
+        for (size_t i = 0; i < vBlocks.size(); i++)
+            g_read_ahead_blocks.emplace_back(chainActive[50 + i], vBlocks[i]);
+    };
+
+    // A block at the same height but of another chain is not taken
+    CBlockIndex indexOther;
+    uint256 hashOther = InsecureRand256();
+    indexOther.phashBlock = &hashOther;
+    indexOther.nHeight = 51;
+    indexOther.pprev = chainActive[50];
+    readAhead();
+    BOOST_CHECK(TakeReadAheadBlock(&indexOther) == nullptr);
+    BOOST_CHECK(g_read_ahead_blocks.empty());
+
+    // Neither is a block of this chain that was not read ahead
+    readAhead();
+    BOOST_CHECK(TakeReadAheadBlock(chainActive[60]) == nullptr);
+    BOOST_CHECK(g_read_ahead_blocks.empty());
+
+    // The right one is, and the blocks read ahead before it are dropped
+    readAhead();
+    std::shared_ptr<const CBlock> pblock = TakeReadAheadBlock(chainActive[51]);
+    BOOST_REQUIRE(pblock);
+    BOOST_CHECK(pblock->GetHash() == chainActive[51]->GetBlockHash());
+    BOOST_REQUIRE_EQUAL(g_read_ahead_blocks.size(), 1U);
+    BOOST_CHECK(g_read_ahead_blocks.front().first == chainActive[52]);
+
+    // Once the chain moves past them, the rest are discarded as well
+    BOOST_CHECK(TakeReadAheadBlock(chainActive[53]) == nullptr);
+    BOOST_CHECK(g_read_ahead_blocks.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
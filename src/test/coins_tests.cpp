@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -52,7 +53,7 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const MuHash3072& hashUTXODelta) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -586,9 +587,10 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
-    view.BatchWrite(map, {});
+    view.BatchWrite(map, {}, MuHash3072());
 }
 
 class SingleEntryCacheTest
@@ -656,6 +658,37 @@ BOOST_AUTO_TEST_CASE(ccoins_access)
     CheckAccessCoin(VALUE1, VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
 }
 
+void CheckCacheFetchedCoin(CAmount cache_value, CAmount fetched_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+    Coin coin;
+    SetCoinsValue(fetched_value, coin);
+    test.cache.CacheFetchedCoin(OUTPOINT, std::move(coin));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cache_fetched)
+{
+    /* Check CacheFetchedCoin behavior: a coin read from the base view only
+     * fills in a missing entry, and spent coins are not cached.
+     *
+     *                    Cache   Fetched Result  Cache        Result
+     *                    Value   Value   Value   Flags        Flags
+     */
+    CheckCacheFetchedCoin(ABSENT, PRUNED, ABSENT, NO_ENTRY   , NO_ENTRY   );
+    CheckCacheFetchedCoin(ABSENT, VALUE1, VALUE1, NO_ENTRY   , 0          );
+    CheckCacheFetchedCoin(PRUNED, VALUE1, PRUNED, 0          , 0          );
+    CheckCacheFetchedCoin(PRUNED, VALUE1, PRUNED, DIRTY      , DIRTY      );
+    CheckCacheFetchedCoin(VALUE2, VALUE1, VALUE2, 0          , 0          );
+    CheckCacheFetchedCoin(VALUE2, VALUE1, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
 void CheckSpendCoins(CAmount base_value, CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
 {
     SingleEntryCacheTest test(base_value, cache_value, cache_flags);
@@ -855,4 +888,205 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+
+BOOST_AUTO_TEST_CASE(ccoins_partial_flush)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> outpoints;
+    for (uint32_t nHeight = 1; nHeight <= 100; nHeight++) {
+        for (uint32_t i = 0; i < 10; i++) {
+            COutPoint outpoint(InsecureRand256(), i);
+            Coin coin;
+            coin.out.nValue = nHeight;
+            coin.out.scriptPubKey = CScript() << OP_TRUE;
+            coin.nHeight = nHeight;
+            cache.AddCoin(outpoint, std::move(coin), false);
+            outpoints.push_back(outpoint);
+        }
+    }
+    // Spend one coin of every height.
+    for (size_t i = 0; i < outpoints.size(); i += 10)
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    cache.SetBestBlock(InsecureRand256());
+
+    // Leave room for the nine unspent coins of each of the last 20 heights.
+    const size_t nEntryUsage = sizeof(CCoinsMap::value_type) + 2 * sizeof(void*);
+    BOOST_CHECK(cache.PartialFlush(9 * 20 * nEntryUsage));
+    cache.SelfTest();
+
+    // Every modification reached the base.
+    for (size_t i = 0; i < outpoints.size(); i++)
+        BOOST_CHECK_EQUAL(base.HaveCoin(outpoints[i]), i % 10 != 0);
+
+    // Only the unspent coins of the most recent heights stay cached, unmodified.
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9U * 20U);
+    for (const CCoinsMap::value_type& entry : cache.map()) {
+        BOOST_CHECK(!entry.second.coin.IsSpent());
+        BOOST_CHECK(entry.second.coin.nHeight > 80);
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+    }
+    BOOST_CHECK(cache.GetBestBlock() == base.GetBestBlock());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_background_write, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    const COutPoint outA(InsecureRand256(), 0);
+    const COutPoint outB(InsecureRand256(), 1);
+    const uint256 hash1 = InsecureRand256();
+    const uint256 hash2 = InsecureRand256();
+
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    CCoinsCacheEntry dirty;
+    SetCoinsValue(VALUE1, dirty.coin);
+    dirty.flags = DIRTY;
+    CCoinsCacheEntry clean;
+    SetCoinsValue(VALUE2, clean.coin);
+    map.emplace(outA, dirty);
+    map.emplace(outB, clean);
+
+    // The written coins are visible right away, whether or not the
+    // background write has finished; unmodified entries are not written.
+    BOOST_CHECK(db.BatchWrite(map, hash1, MuHash3072()));
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(db.HaveCoin(outA));
+    BOOST_CHECK(!db.HaveCoin(outB));
+    BOOST_CHECK(db.GetBestBlock() == hash1);
+
+    // A second write waits for the first one, and spends take effect.
+    CCoinsCacheEntry spent;
+    spent.flags = DIRTY;
+    map.emplace(outA, spent);
+    BOOST_CHECK(db.BatchWrite(map, hash2, MuHash3072()));
+    Coin coin;
+    BOOST_CHECK(!db.GetCoin(outA, coin));
+    BOOST_CHECK(db.GetBestBlock() == hash2);
+
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK(!db.HaveCoin(outA));
+    BOOST_CHECK(db.GetBestBlock() == hash2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    BOOST_CHECK(cursor->GetBestBlock() == hash2);
+    BOOST_CHECK(!cursor->Valid());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_get_many, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 60; i++) {
+            outpoints.emplace_back(InsecureRand256(), InsecureRandRange(3));
+            Coin coin;
+            coin.out.nValue = i + 1;
+            coin.nHeight = i;
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.Sync());
+    {
+        // Leave spends of every fifth coin in a write that may still be pending.
+        CCoinsViewCache cache(&db);
+        for (size_t i = 0; i < outpoints.size(); i += 5)
+            BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+    // Some outpoints were never created.
+    for (int i = 0; i < 10; i++)
+        outpoints.emplace_back(InsecureRand256(), 0);
+
+    CCoinsViewCache cache(&db);
+    Coin cached;
+    BOOST_CHECK(cache.GetCoin(outpoints[1], cached));
+    std::vector<Coin> coins(outpoints.size());
+    BOOST_CHECK_EQUAL(db.GetCoins(outpoints.data(), coins.data(), coins.size()), 48U);
+    std::vector<Coin> coinsCache(outpoints.size());
+    BOOST_CHECK_EQUAL(cache.GetCoins(outpoints.data(), coinsCache.data(), coinsCache.size()), 48U);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin coin;
+        bool fHave = db.GetCoin(outpoints[i], coin);
+        BOOST_CHECK_EQUAL(!coins[i].IsSpent(), fHave);
+        BOOST_CHECK_EQUAL(!coinsCache[i].IsSpent(), fHave);
+        if (fHave) {
+            BOOST_CHECK(coins[i].out == coin.out && coins[i].nHeight == coin.nHeight);
+            BOOST_CHECK(coinsCache[i].out == coin.out && coinsCache[i].nHeight == coin.nHeight);
+            // The coins fetched through the cache stay in it.
+            BOOST_CHECK(cache.HaveCoinInCache(outpoints[i]));
+        }
+    }
+}
+
+static uint256 FinalizeUTXOSetHash(MuHash3072 hash)
+{
+    unsigned char out[32];
+    hash.Finalize(out);
+    return uint256(std::vector<unsigned char>(out, out + sizeof(out)));
+}
+
+static uint256 ComputeUTXOSetHash(CCoinsView& view)
+{
+    MuHash3072 hash;
+    std::unique_ptr<CCoinsViewCursor> cursor(view.Cursor());
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(cursor->GetKey(key) && cursor->GetValue(coin));
+        ApplyCoinHash(hash, key, coin);
+    }
+    return FinalizeUTXOSetHash(hash);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_utxo_set_hash, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    MuHash3072 hash;
+    BOOST_CHECK(db.GetUTXOSetHash(hash));
+    BOOST_CHECK(FinalizeUTXOSetHash(hash) == FinalizeUTXOSetHash(MuHash3072()));
+
+    std::vector<COutPoint> outpoints;
+    for (int round = 0; round < 8; ++round) {
+        CCoinsViewCache base(&db);
+        CCoinsViewCache cache(&base);
+        for (int i = 0; i < 20; ++i) {
+            COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+            Coin coin;
+            coin.out.nValue = InsecureRandRange(1000) + 1;
+            coin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+            coin.nHeight = round;
+            coin.fCoinBase = InsecureRandBool();
+            cache.AddCoin(outpoint, std::move(coin), false);
+            outpoints.push_back(outpoint);
+        }
+        for (int i = 0; i < 10 && !outpoints.empty(); ++i) {
+            size_t pos = InsecureRandRange(outpoints.size());
+            cache.SpendCoin(outpoints[pos]);
+            outpoints.erase(outpoints.begin() + pos);
+        }
+
+        // Every layer reports the hash of the set it would flush into.
+        BOOST_CHECK(cache.GetUTXOSetHash(hash));
+        const uint256 expected = FinalizeUTXOSetHash(hash);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(base.GetUTXOSetHash(hash));
+        BOOST_CHECK(FinalizeUTXOSetHash(hash) == expected);
+        BOOST_CHECK(base.Flush());
+        BOOST_CHECK(db.GetUTXOSetHash(hash));
+        BOOST_CHECK(FinalizeUTXOSetHash(hash) == expected);
+
+        BOOST_CHECK(db.Sync());
+        BOOST_CHECK(ComputeUTXOSetHash(db) == expected);
+    }
+    BOOST_CHECK(db.InitUTXOSetHash());
+    BOOST_CHECK(db.GetUTXOSetHash(hash));
+    BOOST_CHECK(FinalizeUTXOSetHash(hash) == ComputeUTXOSetHash(db));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,7 +10,10 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "hash.h"
 #include "random.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_herbsters.h"
 
@@ -505,4 +508,77 @@ BOOST_AUTO_TEST_CASE(countbits_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Cover every combination of 8-way, 4-way and single-block batches.
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = InsecureRand32() & 0xff;
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+static uint256 MuHashDigest(MuHash3072 hash)
+{
+    unsigned char out[32];
+    hash.Finalize(out);
+    return uint256(std::vector<unsigned char>(out, out + sizeof(out)));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    std::vector<std::vector<unsigned char>> elements;
+    for (int i = 0; i < 8; ++i) {
+        elements.push_back(ParseHex(InsecureRand256().GetHex()));
+    }
+
+    // The hash does not depend on the order elements are added in.
+    MuHash3072 forward, backward;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        forward.Insert(elements[i].data(), elements[i].size());
+        const std::vector<unsigned char>& element = elements[elements.size() - 1 - i];
+        backward.Insert(element.data(), element.size());
+    }
+    BOOST_CHECK(MuHashDigest(forward) == MuHashDigest(backward));
+    BOOST_CHECK(MuHashDigest(forward) != MuHashDigest(MuHash3072()));
+
+    // Removing what was added gives back the empty set, in any order.
+    MuHash3072 removed = forward;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        const std::vector<unsigned char>& element = elements[(i * 3) % elements.size()];
+        removed.Remove(element.data(), element.size());
+    }
+    BOOST_CHECK(MuHashDigest(removed) == MuHashDigest(MuHash3072()));
+
+    // Combining the hashes of disjoint sets.
+    MuHash3072 first, second;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        (i % 2 ? first : second).Insert(elements[i].data(), elements[i].size());
+    }
+    MuHash3072 combined = first;
+    combined *= second;
+    BOOST_CHECK(MuHashDigest(combined) == MuHashDigest(forward));
+    combined /= second;
+    BOOST_CHECK(MuHashDigest(combined) == MuHashDigest(first));
+
+    // Serialization keeps the pending denominator.
+    MuHash3072 partial = forward;
+    partial.Remove(elements[0].data(), elements[0].size());
+    CDataStream ss(SER_DISK, 0);
+    ss << partial;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 read;
+    ss >> read;
+    BOOST_CHECK(MuHashDigest(read) == MuHashDigest(partial));
+    forward.Remove(elements[0].data(), elements[0].size());
+    BOOST_CHECK(MuHashDigest(read) == MuHashDigest(forward));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -317,6 +317,88 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    for (bool obfuscate : {false, true}) {
+        fs::path ph = fs::temp_directory_path() / fs::unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
 
+        std::vector<uint256> keys;
+        for (int i = 0; i < 100; i++) {
+            keys.push_back(InsecureRand256());
+            if (i % 3)
+                BOOST_CHECK(dbw.Write(std::make_pair('k', keys.back()), (uint32_t)i));
+        }
+        // Unsorted keys, keys past the last one in the database, and duplicates.
+        keys.push_back(uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
+        keys.push_back(keys[1]);
+
+        std::vector<std::pair<char, uint256>> dbkeys;
+        for (const uint256& key : keys)
+            dbkeys.emplace_back('k', key);
+        std::vector<uint32_t> values;
+        std::vector<bool> found;
+        BOOST_CHECK_EQUAL(dbw.ReadMany(dbkeys, values, found), 67U);
+        BOOST_CHECK_EQUAL(values.size(), keys.size());
+        for (size_t i = 0; i < dbkeys.size(); i++) {
+            uint32_t value;
+            bool fRead = dbw.Read(dbkeys[i], value);
+            BOOST_CHECK_EQUAL(found[i], fRead);
+            if (fRead)
+                BOOST_CHECK_EQUAL(values[i], value);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    const char* argv[] = {"ignored", "-dbmaxopenfiles=chainstate:1000", "-dbmaxopenfiles=200", "-dbbloombits=0", "-dbbloombits=index:12", "-dbblocksize=16384"};
+    gArgs.ParseParameters(sizeof(argv) / sizeof(argv[0]), argv);
+
+    // A value for the named database wins over a plain one, in any order.
+    CDBOptions chainstate = GetDBOptions("chainstate");
+    BOOST_CHECK_EQUAL(chainstate.nMaxOpenFiles, 1000);
+    BOOST_CHECK_EQUAL(chainstate.nBloomBits, 0);
+    BOOST_CHECK_EQUAL(chainstate.nBlockSize, 16384U);
+    BOOST_CHECK_EQUAL(chainstate.fCompression, DEFAULT_DB_COMPRESSION);
+    CDBOptions index = GetDBOptions("index");
+    BOOST_CHECK_EQUAL(index.nMaxOpenFiles, 200);
+    BOOST_CHECK_EQUAL(index.nBloomBits, 12);
+    BOOST_CHECK_EQUAL(index.nBlockSize, 16384U);
+
+    // The database takes its settings from the last component of its path.
+    fs::path ph = fs::temp_directory_path() / fs::unique_path() / "chainstate";
+    CDBWrapper dbw(ph, (1 << 20), true, false, false);
+    BOOST_CHECK_EQUAL(dbw.GetName(), "chainstate");
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().nMaxOpenFiles, 1000);
+    BOOST_CHECK(dbw.Write('k', uint256()));
+    std::string value;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", value));
+    BOOST_CHECK(dbw.GetProperty("leveldb.approximate-memory-usage", value));
+    BOOST_CHECK(atoi64(value) > 0);
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", value));
+
+    std::string strError;
+    BOOST_CHECK(CheckDBOptions(strError));
+
+    gArgs.ParseParameters(1, argv);
+    BOOST_CHECK_EQUAL(GetDBOptions("chainstate").nMaxOpenFiles, DEFAULT_DB_MAX_OPEN_FILES);
+    BOOST_CHECK(CheckDBOptions(strError));
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options_invalid)
+{
+    // Zero and negative sizes are rejected, for all databases or for one;
+    // zero bloom bits disable the filters, but fewer are rejected.
+    for (const char* arg : {"-dbmaxopenfiles=0", "-dbmaxopenfiles=index:-5", "-dbblocksize=-1", "-dbwritebuffer=0", "-dbwritebuffer=chainstate:x", "-dbbloombits=-1"}) {
+        const char* argv[] = {"ignored", arg};
+        gArgs.ParseParameters(2, argv);
+        std::string strError;
+        BOOST_CHECK(!CheckDBOptions(strError));
+        BOOST_CHECK(strError.find(std::string(arg).substr(0, std::string(arg).find('='))) != std::string::npos);
+    }
+    const char* argv[] = {"ignored"};
+    gArgs.ParseParameters(1, argv);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
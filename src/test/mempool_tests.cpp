@@ -427,6 +427,43 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRelayInfoTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).FromTx(tx2));
+    pool.PrioritiseTransaction(tx2.GetHash(), 5000LL);
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].nValue = 1 * COIN;
+
+    // Transactions not in the mempool are left out.
+    std::vector<TxMempoolRelayInfo> vInfo = pool.relayInfo({tx2.GetHash(), tx3.GetHash(), tx1.GetHash()});
+    BOOST_CHECK_EQUAL(vInfo.size(), 2U);
+    BOOST_CHECK(vInfo[0].tx->GetHash() == tx2.GetHash());
+    BOOST_CHECK_EQUAL(vInfo[0].nCountWithAncestors, 2U);
+    BOOST_CHECK_EQUAL(vInfo[0].nModFee, 25000LL);
+    BOOST_CHECK_EQUAL(vInfo[0].nTxSize, GetVirtualTransactionSize(tx2));
+    BOOST_CHECK(vInfo[0].feeRate == CFeeRate(20000LL, GetVirtualTransactionSize(tx2)));
+    BOOST_CHECK(vInfo[1].tx->GetHash() == tx1.GetHash());
+    BOOST_CHECK_EQUAL(vInfo[1].nCountWithAncestors, 1U);
+    BOOST_CHECK_EQUAL(vInfo[1].nModFee, 10000LL);
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
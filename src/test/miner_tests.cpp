@@ -11,6 +11,7 @@
 #include "validation.h"
 #include "miner.h"
 #include "policy/policy.h"
+#include "pow.h"
 #include "pubkey.h"
 #include "script/standard.h"
 #include "txmempool.h"
@@ -502,4 +503,37 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(GrindBlockNonce_threads)
+{
+    // A target that about every other hash meets
+    Consensus::Params consensusParams = Params().GetConsensus();
+    consensusParams.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = InsecureRand256();
+    block.hashMerkleRoot = InsecureRand256();
+    block.nTime = 1500000000;
+    block.nBits = 0x207fffff;
+
+    CBlock blockSerial = block;
+    const uint32_t nTried = GrindBlockNonce(&blockSerial, 0x10000, 1, consensusParams);
+    BOOST_CHECK(blockSerial.nNonce < 0x10000);
+    BOOST_CHECK_EQUAL(nTried, blockSerial.nNonce + 1);
+    BOOST_CHECK(CheckProofOfWork(blockSerial.GetPoWHash(), blockSerial.nBits, consensusParams));
+
+    // More threads find the same, lowest, nonce and have all exited on return
+    for (int nThreads : {2, 4, 8}) {
+        CBlock blockThreads = block;
+        BOOST_CHECK_EQUAL(GrindBlockNonce(&blockThreads, 0x10000, nThreads, consensusParams), nTried);
+        BOOST_CHECK_EQUAL(blockThreads.nNonce, blockSerial.nNonce);
+        BOOST_CHECK(CheckProofOfWork(blockThreads.GetPoWHash(), blockThreads.nBits, consensusParams));
+    }
+
+    // A search that finds nothing spends every nonce
+    CBlock blockHard = block;
+    blockHard.nBits = 0x1d00ffff;
+    BOOST_CHECK_EQUAL(GrindBlockNonce(&blockHard, 1000, 4, consensusParams), 1000);
+    BOOST_CHECK_EQUAL(blockHard.nNonce, 1000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
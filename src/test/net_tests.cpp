@@ -4,6 +4,7 @@
 #include "addrman.h"
 #include "test/test_herbsters.h"
 #include <string>
+#include <thread>
 #include <boost/test/unit_test.hpp>
 #include "hash.h"
 #include "serialize.h"
@@ -71,6 +72,36 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+/** Records the threads each peer's messages are handled on, and which peers were finalized */
+class ShardRecorder : public NetEventsInterface
+{
+public:
+    std::mutex cs;
+    std::map<NodeId, std::set<std::thread::id>> mapThreads;
+    std::map<NodeId, int> mapCalls;
+    std::set<NodeId> setFinalized;
+
+    bool ProcessMessages(CNode* pnode, std::atomic<bool>& interrupt) override
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        mapThreads[pnode->GetId()].insert(std::this_thread::get_id());
+        mapCalls[pnode->GetId()]++;
+        return false;
+    }
+    bool SendMessages(CNode* pnode, std::atomic<bool>& interrupt) override
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        mapThreads[pnode->GetId()].insert(std::this_thread::get_id());
+        return true;
+    }
+    void InitializeNode(CNode* pnode) override {}
+    void FinalizeNode(NodeId id, bool& update_connection_time) override
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        setFinalized.insert(id);
+    }
+};
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(cnode_listen_port)
@@ -185,4 +216,215 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cconnman_message_handler_shards)
+{
+    const int nThreads = 3;
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr = CAddress(CService(CNetAddr(), 7777), NODE_NETWORK);
+    std::vector<std::unique_ptr<CNode>> nodes;
+    for (NodeId id = 0; id < 10; id++) {
+        nodes.emplace_back(new CNode(id, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", true));
+        CConnmanTest::AddNode(connman, *nodes.back());
+    }
+
+    ShardRecorder recorder;
+    CConnmanTest::StartMessageHandlers(connman, &recorder, nThreads);
+    // The handlers wake up at least every 100ms; wait until each peer was
+    // serviced a few times.
+    for (int i = 0; i < 1000; i++) {
+        {
+            std::lock_guard<std::mutex> lock(recorder.cs);
+            if (recorder.mapCalls.size() == nodes.size() &&
+                std::all_of(recorder.mapCalls.begin(), recorder.mapCalls.end(), [](const std::pair<const NodeId, int>& calls) { return calls.second >= 3; }))
+                break;
+        }
+        MilliSleep(10);
+    }
+    CConnmanTest::StopMessageHandlers(connman);
+    CConnmanTest::ClearNodes(connman);
+
+    // Every peer was serviced by exactly one thread, the same one as the
+    // other peers of its shard, and each shard had a thread of its own.
+    BOOST_REQUIRE_EQUAL(recorder.mapThreads.size(), nodes.size());
+    std::map<int, std::thread::id> mapShardThread;
+    std::set<std::thread::id> setThreads;
+    for (const auto& entry : recorder.mapThreads) {
+        BOOST_REQUIRE_EQUAL(entry.second.size(), 1U);
+        const std::thread::id thread = *entry.second.begin();
+        const int nShard = entry.first % nThreads;
+        if (mapShardThread.count(nShard))
+            BOOST_CHECK(mapShardThread[nShard] == thread);
+        mapShardThread[nShard] = thread;
+        setThreads.insert(thread);
+    }
+    BOOST_CHECK_EQUAL(setThreads.size(), (size_t)nThreads);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(cnode_send_prepared_messages)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr = CAddress(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress(), "", false);
+
+    // Messages larger than the socket buffer, so sends are partial
+    CSerializedNetMsg msgBig;
+    msgBig.command = "block";
+    msgBig.data.resize(1000000);
+    for (size_t i = 0; i < msgBig.data.size(); i++)
+        msgBig.data[i] = i * 7;
+    CSerializedNetMsg msgEmpty;
+    msgEmpty.command = "verack";
+    CSerializedNetMsg msgSmall;
+    msgSmall.command = "ping";
+    msgSmall.data.assign(8, 0x42);
+
+    CPreparedNetMsgRef pmsgBig = CConnman::PrepareMessage(std::move(msgBig));
+    CPreparedNetMsgRef pmsgEmpty = CConnman::PrepareMessage(std::move(msgEmpty));
+    BOOST_CHECK_EQUAL(pmsgBig->header.size(), CMessageHeader::HEADER_SIZE);
+    BOOST_CHECK_EQUAL(pmsgBig->size(), CMessageHeader::HEADER_SIZE + 1000000);
+    BOOST_CHECK_EQUAL(pmsgEmpty->size(), CMessageHeader::HEADER_SIZE);
+
+    std::vector<unsigned char> expected;
+    for (const CPreparedNetMsgRef& pmsg : {pmsgBig, pmsgEmpty, pmsgBig}) {
+        connman.PushMessage(&node, pmsg);
+        expected.insert(expected.end(), pmsg->header.begin(), pmsg->header.end());
+        expected.insert(expected.end(), pmsg->data.begin(), pmsg->data.end());
+    }
+    connman.PushMessage(&node, std::move(msgSmall));
+    BOOST_CHECK_EQUAL(node.vSendMsg.back()->command, "ping");
+    expected.insert(expected.end(), node.vSendMsg.back()->header.begin(), node.vSendMsg.back()->header.end());
+    expected.insert(expected.end(), 8, 0x42);
+
+    // The first message did not fit into the socket buffer, and the same
+    // message queued twice is shared rather than copied
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 4U);
+    BOOST_CHECK(node.vSendMsg[0] == pmsgBig);
+    BOOST_CHECK(node.vSendMsg[2] == pmsgBig);
+    BOOST_CHECK(node.nSendOffset > 0);
+
+    std::vector<unsigned char> received;
+    unsigned char buf[65536];
+    while (received.size() < expected.size()) {
+        ssize_t nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (nBytes > 0) {
+            received.insert(received.end(), buf, buf + nBytes);
+        } else {
+            BOOST_REQUIRE(nBytes < 0 && errno == EWOULDBLOCK);
+            BOOST_REQUIRE(!node.vSendMsg.empty());
+            CConnmanTest::SocketSendData(connman, node);
+        }
+    }
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+    BOOST_CHECK_EQUAL(node.nSendBytes, expected.size());
+    BOOST_CHECK(received == expected);
+    close(fds[1]);
+}
+
+#ifdef USE_EPOLL
+BOOST_AUTO_TEST_CASE(cconnman_epoll_socket_events)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    ShardRecorder recorder;
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr = CAddress(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CConnmanTest::StartSocketHandler(connman, &recorder);
+    // Owned by connman once added, like an accepted connection
+    CNode* pnode = new CNode(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress(), "", true);
+    BOOST_REQUIRE(CConnmanTest::AddSocketNode(connman, *pnode));
+    // Keep the node alive after it is disconnected, until checked
+    pnode->AddRef();
+
+    // Readable: a message written by the peer is received and queued for
+    // processing by the socket handler
+    CSerializedNetMsg msgPing;
+    msgPing.command = "ping";
+    msgPing.data.assign(8, 0x42);
+    CPreparedNetMsgRef pmsgPing = CConnman::PrepareMessage(std::move(msgPing));
+    std::vector<unsigned char> vPing(pmsgPing->header.begin(), pmsgPing->header.end());
+    vPing.insert(vPing.end(), pmsgPing->data.begin(), pmsgPing->data.end());
+    BOOST_REQUIRE_EQUAL(send(fds[1], vPing.data(), vPing.size(), 0), (ssize_t)vPing.size());
+    bool fReceived = false;
+    for (int i = 0; i < 1000 && !fReceived; i++) {
+        {
+            LOCK(pnode->cs_vProcessMsg);
+            fReceived = !pnode->vProcessMsg.empty();
+        }
+        if (!fReceived)
+            MilliSleep(10);
+    }
+    BOOST_REQUIRE(fReceived);
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        BOOST_REQUIRE_EQUAL(pnode->vProcessMsg.size(), 1U);
+        BOOST_CHECK_EQUAL(pnode->vProcessMsg.front().hdr.GetCommand(), "ping");
+        // Without a receive flood size any queued message pauses receiving;
+        // take it off the queue as the message handler would
+        BOOST_CHECK(pnode->fPauseRecv);
+        pnode->vProcessMsg.clear();
+        pnode->nProcessQueueSize = 0;
+        pnode->fPauseRecv = false;
+    }
+
+    // Writable: a message larger than the socket buffer is only partly sent
+    // by PushMessage, and the socket handler sends the rest as the peer reads
+    CSerializedNetMsg msgBig;
+    msgBig.command = "block";
+    msgBig.data.resize(1000000);
+    for (size_t i = 0; i < msgBig.data.size(); i++)
+        msgBig.data[i] = i * 7;
+    CPreparedNetMsgRef pmsgBig = CConnman::PrepareMessage(std::move(msgBig));
+    std::vector<unsigned char> expected(pmsgBig->header.begin(), pmsgBig->header.end());
+    expected.insert(expected.end(), pmsgBig->data.begin(), pmsgBig->data.end());
+    connman.PushMessage(pnode, pmsgBig);
+    std::vector<unsigned char> received;
+    unsigned char buf[65536];
+    for (int i = 0; i < 1000 && received.size() < expected.size(); i++) {
+        ssize_t nBytes;
+        while ((nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            received.insert(received.end(), buf, buf + nBytes);
+        if (received.size() < expected.size())
+            MilliSleep(10);
+    }
+    BOOST_CHECK(received == expected);
+    {
+        LOCK(pnode->cs_vSend);
+        BOOST_CHECK(pnode->vSendMsg.empty());
+        BOOST_CHECK_EQUAL(pnode->nSendBytes, expected.size());
+    }
+
+    // Hangup: the peer closing its end disconnects the node, which is removed
+    // from connman and has its socket closed, taking it out of the epoll set
+    close(fds[1]);
+    for (int i = 0; i < 1000 && connman.GetNodeCount(CConnman::CONNECTIONS_ALL) != 0; i++)
+        MilliSleep(10);
+    BOOST_CHECK_EQUAL(connman.GetNodeCount(CConnman::CONNECTIONS_ALL), 0U);
+    BOOST_CHECK(pnode->fDisconnect);
+    {
+        LOCK(pnode->cs_hSocket);
+        BOOST_CHECK(pnode->hSocket == INVALID_SOCKET);
+    }
+
+    // Once the last reference is released the node is finalized and deleted
+    pnode->Release();
+    bool fFinalized = false;
+    for (int i = 0; i < 1000 && !fFinalized; i++) {
+        {
+            std::lock_guard<std::mutex> lock(recorder.cs);
+            fFinalized = recorder.setFinalized.count(0);
+        }
+        if (!fFinalized)
+            MilliSleep(10);
+    }
+    CConnmanTest::StopSocketHandler(connman);
+    BOOST_CHECK(fFinalized);
+}
+#endif
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
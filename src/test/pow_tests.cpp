@@ -6,7 +6,10 @@
 #include "chainparams.h"
 #include "pow.h"
 #include "random.h"
+#include "streams.h"
 #include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
 #include "test/test_herbsters.h"
 
 #include <boost/test/unit_test.hpp>
@@ -83,4 +86,68 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/** Main chain headers with valid proof of work */
+static std::vector<CBlockHeader> ReadTestHeaders()
+{
+    const char* headerhex[] = { "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659", "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01", "02000000a72c8a177f523946f42f22c3e86b8023221b4105e8007e59e81f6beb013e29aaf635295cb9ac966213fb56e046dc71df5b3f7f67ceaeab24038e743f883aff1aaafaf551eac7471b0166249b" };
+    std::vector<CBlockHeader> headers;
+    for (const char* hex : headerhex) {
+        CDataStream stream(ParseHex(hex), SER_NETWORK, PROTOCOL_VERSION);
+        CBlockHeader header;
+        stream >> header;
+        headers.push_back(header);
+    }
+    return headers;
+}
+
+BOOST_AUTO_TEST_CASE(pow_check_batch)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    std::vector<CBlockHeader> headers = ReadTestHeaders();
+
+    std::vector<unsigned char> results(headers.size(), CPoWCheck::UNCHECKED);
+    BOOST_CHECK(CPoWCheck(headers.data(), headers.size(), chainParams->GetConsensus(), results.data())());
+    BOOST_CHECK(results == std::vector<unsigned char>(headers.size(), CPoWCheck::VALID));
+
+    // A single header without valid work fails the whole batch, and is the
+    // one reported as invalid
+    headers[1].nNonce++;
+    BOOST_CHECK(!CPoWCheck(headers.data(), headers.size(), chainParams->GetConsensus(), results.data())());
+    BOOST_CHECK_EQUAL(results[0], CPoWCheck::VALID);
+    BOOST_CHECK_EQUAL(results[1], CPoWCheck::INVALID);
+    BOOST_CHECK_EQUAL(results[2], CPoWCheck::VALID);
+    BOOST_CHECK(CPoWCheck(headers.data(), 1, chainParams->GetConsensus(), results.data())());
+}
+
+BOOST_AUTO_TEST_CASE(block_index_pow)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const std::vector<CBlockHeader> headers = ReadTestHeaders();
+    // Index entries take the previous block hash from their parent
+    std::vector<uint256> hashes, hashesPrev;
+    for (const CBlockHeader& header : headers) {
+        hashes.push_back(header.GetHash());
+        hashesPrev.push_back(header.hashPrevBlock);
+    }
+    std::vector<CBlockIndex> index(headers.begin(), headers.end());
+    std::vector<CBlockIndex> indexPrev(headers.size());
+    std::vector<const CBlockIndex*> vpindex;
+    for (size_t i = 0; i < index.size(); i++) {
+        index[i].phashBlock = &hashes[i];
+        indexPrev[i].phashBlock = &hashesPrev[i];
+        index[i].pprev = &indexPrev[i];
+        vpindex.push_back(&index[i]);
+    }
+    BOOST_CHECK(CheckBlockIndexPoW(vpindex.data(), vpindex.size(), chainParams->GetConsensus()) == nullptr);
+
+    // An entry whose stored header no longer matches its proof of work is
+    // reported, whether its target or its nonce was corrupted
+    index[1].nBits++;
+    BOOST_CHECK(CheckBlockIndexPoW(vpindex.data(), vpindex.size(), chainParams->GetConsensus()) == &index[1]);
+    index[1].nBits--;
+    index[2].nNonce++;
+    BOOST_CHECK(CheckBlockIndexPoW(vpindex.data(), vpindex.size(), chainParams->GetConsensus()) == &index[2]);
+    BOOST_CHECK(CheckBlockIndexPoW(vpindex.data(), 2, chainParams->GetConsensus()) == nullptr);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
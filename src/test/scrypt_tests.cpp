@@ -32,4 +32,54 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi_hashtest)
+{
+    // Batches that fill whole kernels, leave a padded tail, or have a single input
+    // must all agree with the generic implementation
+    const char* inputhex = "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659";
+    const size_t counts[] = { 1, 5, 8, 16, 19, 37 };
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+
+    (void) scrypt_detect_multi();
+    for (size_t n : counts) {
+        std::vector<unsigned char> inputs;
+        for (size_t i = 0; i < n; i++) {
+            std::vector<unsigned char> header = ParseHex(inputhex);
+            header[76] = i & 0xff; // vary the nonce
+            inputs.insert(inputs.end(), header.begin(), header.end());
+        }
+        std::vector<uint256> hashes(n);
+        scrypt_1024_1_1_256_multi((const char*)inputs.data(), BEGIN(hashes[0]), n);
+        for (size_t i = 0; i < n; i++) {
+            uint256 expected;
+            scrypt_1024_1_1_256_sp_generic((const char*)&inputs[80 * i], BEGIN(expected), scratchpad);
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected.ToString());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_context_hashtest)
+{
+    // The cached midstate must be used for nonce-only changes and refreshed
+    // whenever the first 64 bytes of the header change
+    const char* inputhex[2] = { "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659", "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01" };
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    ScryptContext context;
+
+    for (int round = 0; round < 2; round++) {
+        for (int h = 0; h < 2; h++) {
+            std::vector<unsigned char> header = ParseHex(inputhex[h]);
+            for (int nonce = 0; nonce < 3; nonce++) {
+                header[76] = nonce;
+                uint256 hash, expected;
+                context.Hash((const char*)header.data(), BEGIN(hash));
+                scrypt_1024_1_1_256_sp_generic((const char*)header.data(), BEGIN(expected), scratchpad);
+                BOOST_CHECK_EQUAL(hash.ToString(), expected.ToString());
+                scrypt_1024_1_1_256((const char*)header.data(), BEGIN(hash));
+                BOOST_CHECK_EQUAL(hash.ToString(), expected.ToString());
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -26,16 +26,90 @@
 
 void CConnmanTest::AddNode(CNode& node)
 {
-    LOCK(g_connman->cs_vNodes);
-    g_connman->vNodes.push_back(&node);
+    AddNode(*g_connman, node);
+}
+
+void CConnmanTest::AddNode(CConnman& connman, CNode& node)
+{
+    LOCK(connman.cs_vNodes);
+    connman.vNodes.push_back(&node);
 }
 
 void CConnmanTest::ClearNodes()
 {
-    LOCK(g_connman->cs_vNodes);
-    g_connman->vNodes.clear();
+    ClearNodes(*g_connman);
+}
+
+void CConnmanTest::ClearNodes(CConnman& connman)
+{
+    LOCK(connman.cs_vNodes);
+    connman.vNodes.clear();
+}
+
+size_t CConnmanTest::SocketSendData(CConnman& connman, CNode& node)
+{
+    LOCK(node.cs_vSend);
+    return connman.SocketSendData(&node);
+}
+
+bool CConnmanTest::SocketRecvData(CConnman& connman, CNode& node)
+{
+    return connman.SocketRecvData(&node);
+}
+
+void CConnmanTest::StartMessageHandlers(CConnman& connman, NetEventsInterface* msgproc, int nThreads)
+{
+    connman.m_msgproc = msgproc;
+    connman.nMessageHandlerThreads = nThreads;
+    {
+        std::unique_lock<std::mutex> lock(connman.mutexMsgProc);
+        connman.flagInterruptMsgProc = false;
+        connman.vMsgProcWake.assign(nThreads, false);
+    }
+    for (int i = 0; i < nThreads; i++)
+        connman.threadMessageHandlers.emplace_back(&CConnman::ThreadMessageHandler, &connman, i);
 }
 
+void CConnmanTest::StopMessageHandlers(CConnman& connman)
+{
+    {
+        std::unique_lock<std::mutex> lock(connman.mutexMsgProc);
+        connman.flagInterruptMsgProc = true;
+    }
+    connman.condMsgProc.notify_all();
+    for (std::thread& thread : connman.threadMessageHandlers)
+        thread.join();
+    connman.threadMessageHandlers.clear();
+}
+
+#ifdef USE_EPOLL
+void CConnmanTest::StartSocketHandler(CConnman& connman, NetEventsInterface* msgproc)
+{
+    connman.m_msgproc = msgproc;
+    connman.epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(connman.epollfd != -1);
+    connman.interruptNet.reset();
+    connman.threadSocketHandler = std::thread(&CConnman::ThreadSocketHandler, &connman);
+}
+
+void CConnmanTest::StopSocketHandler(CConnman& connman)
+{
+    connman.interruptNet();
+    connman.threadSocketHandler.join();
+    close(connman.epollfd);
+    connman.epollfd = -1;
+}
+
+bool CConnmanTest::AddSocketNode(CConnman& connman, CNode& node)
+{
+    node.AddRef();
+    if (!connman.AddSocketEvents(node.hSocket, &node, true))
+        return false;
+    AddNode(connman, node);
+    return true;
+}
+#endif
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -95,6 +169,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i < nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxDecode);
+        for (int i=0; i < nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinPrefetch);
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         peerLogic.reset(new PeerLogicValidation(connman, scheduler));
@@ -110,8 +188,11 @@ TestingSetup::~TestingSetup()
         peerLogic.reset();
         UnloadBlockIndex();
         delete pcoinsTip;
+        pcoinsTip = nullptr;
         delete pcoinsdbview;
+        pcoinsdbview = nullptr;
         delete pblocktree;
+        pblocktree = nullptr;
         fs::remove_all(pathTemp);
 }
 
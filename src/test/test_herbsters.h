@@ -50,14 +50,28 @@ struct BasicTestingSetup {
  */
 class CConnman;
 class CNode;
+class NetEventsInterface;
 struct CConnmanTest {
     static void AddNode(CNode& node);
+    static void AddNode(CConnman& connman, CNode& node);
     static void ClearNodes();
+    static void ClearNodes(CConnman& connman);
+    static size_t SocketSendData(CConnman& connman, CNode& node);
+    static bool SocketRecvData(CConnman& connman, CNode& node);
+    /** Run nThreads message handler threads of connman, handing messages to msgproc */
+    static void StartMessageHandlers(CConnman& connman, NetEventsInterface* msgproc, int nThreads);
+    static void StopMessageHandlers(CConnman& connman);
+#ifdef USE_EPOLL
+    /** Run the socket handler thread of connman on a new epoll set */
+    static void StartSocketHandler(CConnman& connman, NetEventsInterface* msgproc);
+    static void StopSocketHandler(CConnman& connman);
+    /** Register node with the epoll set and add it to connman, as an accepted connection would be */
+    static bool AddSocketNode(CConnman& connman, CNode& node);
+#endif
 };
 
 class PeerLogicValidation;
 struct TestingSetup: public BasicTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     fs::path pathTemp;
     boost::thread_group threadGroup;
     CConnman* connman;
@@ -8,6 +8,7 @@
 
 #include "clientversion.h"
 #include "checkqueue.h"
+#include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
 #include "core_io.h"
@@ -760,4 +761,79 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+
+static CTransactionRef MakeDecodeTestTransaction(int n)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 1 + (n & 1);
+    mtx.vin.resize(1 + n % 3);
+    for (size_t i = 0; i < mtx.vin.size(); i++) {
+        mtx.vin[i].prevout = COutPoint(InsecureRand256(), i);
+        mtx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(n % 80, 0x51);
+        if (n % 2 == 0)
+            mtx.vin[i].scriptWitness.stack.assign(1 + i, std::vector<unsigned char>(n % 100, 0x42));
+    }
+    mtx.vout.resize(1 + n % 2);
+    for (size_t i = 0; i < mtx.vout.size(); i++) {
+        mtx.vout[i].nValue = n * COIN;
+        mtx.vout[i].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(n % 40, 0x6a);
+    }
+    mtx.nLockTime = n;
+    return MakeTransactionRef(std::move(mtx));
+}
+
+BOOST_FIXTURE_TEST_CASE(parallel_tx_decode, TestingSetup)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1234;
+    for (int n = 0; n < 200; n++)
+        block.vtx.push_back(MakeDecodeTestTransaction(n));
+
+    // Small and large vectors take the serial and the queued paths.
+    for (size_t nTx : {size_t(0), size_t(5), block.vtx.size()}) {
+        std::vector<CTransactionRef> vtx(block.vtx.begin(), block.vtx.begin() + nTx);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vtx << uint8_t(0x99);
+
+        std::vector<CTransactionRef> vtxDecoded;
+        DeserializeTransactionsParallel(ss, vtxDecoded);
+        BOOST_CHECK_EQUAL(ss.size(), 1);
+        BOOST_CHECK_EQUAL(vtxDecoded.size(), nTx);
+        for (size_t i = 0; i < nTx; i++) {
+            BOOST_CHECK(vtxDecoded[i]->GetHash() == vtx[i]->GetHash());
+            BOOST_CHECK(vtxDecoded[i]->GetWitnessHash() == vtx[i]->GetWitnessHash());
+        }
+    }
+
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    CBlock blockDecoded;
+    DeserializeBlockParallel(ssBlock, blockDecoded);
+    BOOST_CHECK(ssBlock.empty());
+    BOOST_CHECK(blockDecoded.GetHash() == block.GetHash());
+    BOOST_CHECK(BlockWitnessMerkleRoot(blockDecoded) == BlockWitnessMerkleRoot(block));
+
+    // Without witness serialization the witness data must be ignored, as with s >> vtx.
+    CDataStream ssNoWitness(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ssNoWitness << block.vtx;
+    std::vector<CTransactionRef> vtxNoWitness;
+    DeserializeTransactionsParallel(ssNoWitness, vtxNoWitness);
+    BOOST_CHECK(ssNoWitness.empty());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(vtxNoWitness[i]->GetWitnessHash() == block.vtx[i]->GetHash());
+
+    // Truncated data and unknown optional data are rejected.
+    CDataStream ssTruncated(SER_NETWORK, PROTOCOL_VERSION);
+    ssTruncated << block.vtx;
+    ssTruncated.resize(ssTruncated.size() - 1);
+    std::vector<CTransactionRef> vtxBad;
+    BOOST_CHECK_THROW(DeserializeTransactionsParallel(ssTruncated, vtxBad), std::ios_base::failure);
+
+    CDataStream ssFlags(SER_NETWORK, PROTOCOL_VERSION);
+    ssFlags << block.vtx;
+    ssFlags[1 + 4 + 1] = 0x02; // flag byte of the first (witness) transaction
+    BOOST_CHECK_THROW(DeserializeTransactionsParallel(ssFlags, vtxBad), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
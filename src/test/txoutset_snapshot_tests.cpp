@@ -0,0 +1,165 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coinstats.h"
+#include "consensus/validation.h"
+#include "fs.h"
+#include "script/sign.h"
+#include "test/test_herbsters.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txoutset_snapshot_tests, TestChain100Setup)
+
+/** Spend the first output of a coinbase of the test chain back to the coinbase key. */
+static CMutableTransaction SpendCoinbase(const CTransaction& txCoinbase, const CKey& key, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txCoinbase.GetHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 11 * CENT;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    tx.vout[1].nValue = 12 * CENT;
+    tx.vout[1].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+/** Start over with an empty block index and chainstate, as a new node would. */
+static void ResetChainstate(const CChainParams& chainparams)
+{
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    BOOST_REQUIRE(LoadGenesisBlock(chainparams));
+}
+
+static std::vector<unsigned char> ReadFile(const fs::path& path)
+{
+    std::vector<unsigned char> data(fs::file_size(path));
+    FILE* file = fsbridge::fopen(path, "rb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fread(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+    return data;
+}
+
+static void WriteFile(const fs::path& path, const std::vector<unsigned char>& data)
+{
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+static bool LoadSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashBlock, const uint256& hashSerialized, const std::string& strExpectedError)
+{
+    std::string strError;
+    bool fLoaded = LoadTxOutSet(chainparams, path, hashBlock, hashSerialized, strError);
+    BOOST_CHECK_MESSAGE(strError.find(strExpectedError) != std::string::npos, strError);
+    return fLoaded;
+}
+
+BOOST_AUTO_TEST_CASE(dump_and_load)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // One spend ends up below the snapshot base, one above it.
+    CMutableTransaction txBelow = SpendCoinbase(coinbaseTxns[0], coinbaseKey, scriptPubKey);
+    CreateAndProcessBlock({txBelow}, scriptPubKey);
+    for (int i = 0; i < TXOUTSET_SNAPSHOT_DEPTH; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+    CMutableTransaction txAbove = SpendCoinbase(coinbaseTxns[1], coinbaseKey, scriptPubKey);
+    CreateAndProcessBlock({txAbove}, scriptPubKey);
+    BOOST_CHECK_EQUAL(chainActive.Height(), COINBASE_MATURITY + TXOUTSET_SNAPSHOT_DEPTH + 2);
+
+    const fs::path path = GetDataDir() / "utxo.dat";
+    CCoinsStats stats;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpTxOutSet(path, stats, strError), strError);
+    const CBlockIndex* pindexBase = chainActive[chainActive.Height() - TXOUTSET_SNAPSHOT_DEPTH];
+    BOOST_CHECK(stats.hashBlock == pindexBase->GetBlockHash());
+    BOOST_CHECK_EQUAL(stats.nHeight, pindexBase->nHeight);
+
+    // The snapshot holds the UTXO set at its base, not at the tip.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, chainparams, chainActive[pindexBase->nHeight + 1]));
+        BOOST_CHECK(chainActive.Tip() == pindexBase);
+        FlushStateToDisk();
+    }
+    CCoinsStats statsBase;
+    BOOST_CHECK(GetUTXOStats(pcoinsdbview, statsBase));
+    BOOST_CHECK(statsBase.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK_EQUAL(statsBase.nTransactionOutputs, stats.nTransactionOutputs);
+    const uint256 hashBase = stats.hashBlock;
+    const uint256 hashSerialized = stats.hashSerialized;
+
+    const std::vector<unsigned char> data = ReadFile(path);
+
+    // Flip a bit of the last coin's (compressed P2PK) script, which ends
+    // right before the null txid, coin count and hash of the trailer.
+    const fs::path pathTampered = GetDataDir() / "tampered.dat";
+    std::vector<unsigned char> dataTampered = data;
+    dataTampered[data.size() - 32 - 8 - 32 - 1] ^= 1;
+    WriteFile(pathTampered, dataTampered);
+
+    // Drop the headers that bury the base block. They follow the 47 byte
+    // file header and a header plus a one byte transaction count per block.
+    const fs::path pathShallow = GetDataDir() / "shallow.dat";
+    std::vector<unsigned char> dataShallow(data.begin(), data.begin() + 47 + 81 * pindexBase->nHeight);
+    BOOST_REQUIRE_EQUAL(data[dataShallow.size()], TXOUTSET_SNAPSHOT_DEPTH);
+    dataShallow.push_back(0);
+    dataShallow.insert(dataShallow.end(), data.begin() + dataShallow.size() + 80 * TXOUTSET_SNAPSHOT_DEPTH, data.end());
+    WriteFile(pathShallow, dataShallow);
+
+    ResetChainstate(chainparams);
+    BOOST_CHECK(!LoadSnapshot(chainparams, path, chainparams.GetConsensus().hashGenesisBlock, hashSerialized, "not the expected"));
+    BOOST_CHECK(!LoadSnapshot(chainparams, path, hashBase, uint256S("0x01"), "does not match the expected"));
+    BOOST_CHECK(!LoadSnapshot(chainparams, pathTampered, hashBase, hashSerialized, "corrupt"));
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == chainparams.GetConsensus().hashGenesisBlock);
+
+    BOOST_REQUIRE(LoadSnapshot(chainparams, path, hashBase, hashSerialized, ""));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashBase);
+    BOOST_CHECK_EQUAL(pindexBestHeader->nHeight, chainActive.Height() + TXOUTSET_SNAPSHOT_DEPTH);
+    CCoinsStats statsLoaded;
+    BOOST_CHECK(GetUTXOStats(pcoinsdbview, statsLoaded));
+    BOOST_CHECK(statsLoaded.hashSerialized == hashSerialized);
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactionOutputs, stats.nTransactionOutputs);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(coinbaseTxns[0].GetHash(), 0)));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txBelow.GetHash(), 1)));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(coinbaseTxns[1].GetHash(), 0)));
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(txAbove.GetHash(), 0)));
+
+        // The blocks from the snapshot cannot be disconnected.
+        CValidationState state;
+        BOOST_CHECK(!InvalidateBlock(state, chainparams, chainActive.Tip()));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashBase);
+    }
+
+    // A base block that is not buried deep enough is refused.
+    ResetChainstate(chainparams);
+    BOOST_CHECK(!LoadSnapshot(chainparams, pathShallow, hashBase, hashSerialized, "not buried"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 #include "ui_interface.h"
 #include "init.h"
 
+#include <functional>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -29,6 +30,7 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_UTXO_SET_HASH = 'U';
 
 namespace {
 
@@ -54,19 +56,90 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true),
+    fWriteFailed(false), fShutdown(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        fShutdown = true;
+    }
+    condPending.notify_all();
+    // The writer finishes a pending write before it exits.
+    if (threadWriter.joinable())
+        threadWriter.join();
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->coins.find(outpoint);
+            if (it != pending->coins.end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    // Not part of the write in progress, so the database is up to date for it.
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+size_t CCoinsViewDB::GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const {
+    size_t nFound = 0;
+    std::vector<CoinEntry> vKeys;
+    std::vector<size_t> vKeyPos;
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        for (size_t i = 0; i < count; i++) {
+            if (pending) {
+                CCoinsMap::const_iterator it = pending->coins.find(outpoints[i]);
+                if (it != pending->coins.end()) {
+                    coins[i] = it->second.coin;
+                    nFound += !coins[i].IsSpent();
+                    continue;
+                }
+            }
+            vKeys.emplace_back(&outpoints[i]);
+            vKeyPos.push_back(i);
+        }
+    }
+    std::vector<Coin> vValues;
+    std::vector<bool> vFound;
+    db.ReadMany(vKeys, vValues, vFound);
+    for (size_t j = 0; j < vKeys.size(); j++) {
+        Coin& coin = coins[vKeyPos[j]];
+        if (vFound[j]) {
+            coin = std::move(vValues[j]);
+            nFound++;
+        } else {
+            coin.Clear();
+        }
+    }
+    return nFound;
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->coins.find(outpoint);
+            if (it != pending->coins.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        if (pending)
+            return pending->hashBlock;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -81,15 +154,118 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::GetUTXOSetHash(MuHash3072 &hash) const {
+    {
+        std::lock_guard<std::mutex> lock(cs_pending);
+        if (pending) {
+            if (!pending->fUTXOSetHash)
+                return false;
+            hash = pending->hashUTXOSet;
+            return true;
+        }
+    }
+    return ReadUTXOSetHash(hash);
+}
+
+bool CCoinsViewDB::ReadUTXOSetHash(MuHash3072 &hash) const {
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain)) {
+        // An empty database holds the empty set; one that was interrupted
+        // in the middle of a write has no known hash until it is replayed.
+        if (!GetHeadBlocks().empty())
+            return false;
+        hash = MuHash3072();
+        return true;
+    }
+    std::pair<uint256, MuHash3072> entry;
+    if (!db.Read(DB_UTXO_SET_HASH, entry) || entry.first != hashBestChain)
+        return false;
+    hash = entry.second;
+    return true;
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) {
+    assert(!hashBlock.IsNull());
+
+    // Take the dirty entries over before waiting for the previous write,
+    // which usually overlaps with this.
+    std::unique_ptr<PendingWrite> write(new PendingWrite());
+    write->hashBlock = hashBlock;
+    write->coins.reserve(mapCoins.size());
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            write->coins.emplace(it->first, std::move(it->second));
+        it = mapCoins.erase(it);
+    }
+
+    std::unique_lock<std::mutex> lock(cs_pending);
+    condPending.wait(lock, [this] { return !pending || fWriteFailed; });
+    if (fWriteFailed) {
+        // The failed write stays pending so lookups do not fall back to the
+        // stale database; fold these coins into it for the same reason.
+        for (CCoinsMap::value_type& entry : write->coins)
+            pending->coins[entry.first] = std::move(entry.second);
+        pending->hashBlock = hashBlock;
+        if (pending->fUTXOSetHash)
+            pending->hashUTXOSet *= hashUTXODelta;
+        return false;
+    }
+    write->fUTXOSetHash = ReadUTXOSetHash(write->hashUTXOSet);
+    if (write->fUTXOSetHash)
+        write->hashUTXOSet *= hashUTXODelta;
+    if (!threadWriter.joinable()) {
+        threadWriter = std::thread(&TraceThread<std::function<void()> >, "coinswrite", std::function<void()>(std::bind(&CCoinsViewDB::ThreadWriteCoins, this)));
+    }
+    pending = std::move(write);
+    condPending.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::Sync() const {
+    std::unique_lock<std::mutex> lock(cs_pending);
+    condPending.wait(lock, [this] { return !pending || fWriteFailed; });
+    return !fWriteFailed;
+}
+
+void CCoinsViewDB::ThreadWriteCoins() {
+    std::unique_lock<std::mutex> lock(cs_pending);
+    while (true) {
+        condPending.wait(lock, [this] { return (pending && !fWriteFailed) || fShutdown; });
+        if (!pending || fWriteFailed)
+            return;
+        // Lookups keep reading the pending coins while they are written;
+        // nothing modifies them until they are released below.
+        const PendingWrite& write = *pending;
+        lock.unlock();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(write.coins, write.hashBlock, write.fUTXOSetHash ? &write.hashUTXOSet : nullptr);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (!fOk)
+            LogPrintf("Error: Failed to write to coin database\n");
+        lock.lock();
+        // A failed write is kept, and lookups keep being served from it, as
+        // the database does not have these coins.
+        if (fOk)
+            pending.reset();
+        else
+            fWriteFailed = true;
+        condPending.notify_all();
+    }
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 *phashUTXOSet) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
     size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
-    assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip;
+    if (!db.Read(DB_BEST_BLOCK, old_tip))
+        old_tip.SetNull();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -106,7 +282,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -116,8 +292,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -133,8 +307,14 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     }
 
     // In the last batch, mark the database as consistent with hashBlock again.
+    // The UTXO set hash is only valid together with the best block it was
+    // computed for, so it is committed in the same batch.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (phashUTXOSet)
+        batch.Write(DB_UTXO_SET_HASH, std::make_pair(hashBlock, *phashUTXOSet));
+    else
+        batch.Erase(DB_UTXO_SET_HASH);
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -142,6 +322,38 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::InitUTXOSetHash() {
+    if (!Sync())
+        return false;
+    MuHash3072 hash;
+    if (ReadUTXOSetHash(hash))
+        return true;
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain))
+        return error("%s: coin database is not at a consistent block", __func__);
+
+    LogPrintf("Computing UTXO set hash at %s...\n", hashBestChain.ToString());
+    int64_t nStart = GetTimeMillis();
+    std::unique_ptr<CCoinsViewCursor> pcursor(Cursor());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            LogPrintf("Computing UTXO set hash: CANCELLED\n");
+            return true;
+        }
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            return error("%s: unable to read coin", __func__);
+        ApplyCoinHash(hash, key, coin);
+        pcursor->Next();
+    }
+    if (!db.Write(DB_UTXO_SET_HASH, std::make_pair(hashBestChain, hash), true))
+        return error("%s: failed to write UTXO set hash", __func__);
+    LogPrintf("Computed UTXO set hash in %dms\n", GetTimeMillis() - nStart);
+    return true;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -172,7 +384,13 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
-    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
+    // The cursor iterates the database only, so let a write in progress
+    // finish first, and take the best block from the database as well.
+    Sync();
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain))
+        hashBestChain.SetNull();
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), hashBestChain);
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
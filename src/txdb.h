@@ -10,8 +10,12 @@
 #include "dbwrapper.h"
 #include "chain.h"
 
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -63,24 +67,70 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/**
+ * CCoinsView backed by the coin database.
+ *
+ * BatchWrite does not write to the database itself: it takes the dirty
+ * entries over and hands them to a writer thread, so the caller (normally a
+ * flush of pcoinsTip under cs_main) can continue right away. Until the
+ * writer has committed them, lookups see the handed over coins first. A
+ * new BatchWrite waits for the previous one to be committed, and the
+ * head-blocks markers are written exactly as for a synchronous write. A
+ * write that fails stays pending, so lookups keep seeing its coins, and
+ * every later BatchWrite and Sync fails.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 &hashUTXODelta) override;
+    bool GetUTXOSetHash(MuHash3072 &hash) const override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Wait until the coins handed over by BatchWrite are in the database. Returns false if writing them failed.
+    bool Sync() const;
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
+    //! Compute the rolling UTXO set hash from scratch if the database does not have it for its best block.
+    bool InitUTXOSetHash();
     size_t EstimateSize() const override;
+    const CDBWrapper& GetDB() const { return db; }
+
+private:
+    /** Coins taken over by BatchWrite that are not committed to the database yet */
+    struct PendingWrite
+    {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap coins;
+        uint256 hashBlock;
+        bool fUTXOSetHash; //!< whether hashUTXOSet is known
+        MuHash3072 hashUTXOSet;
+
+        PendingWrite() : coins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource), fUTXOSetHash(false) {}
+    };
+
+    mutable std::mutex cs_pending;
+    mutable std::condition_variable condPending;
+    std::unique_ptr<PendingWrite> pending; //!< null when there is nothing to write; kept if writing it failed
+    bool fWriteFailed;
+    bool fShutdown;
+    std::thread threadWriter;
+
+    //! Write the dirty entries of mapCoins to the database, leaving mapCoins unchanged
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const MuHash3072 *phashUTXOSet);
+    //! Read the UTXO set hash of the committed database state, if it is known
+    bool ReadUTXOSetHash(MuHash3072 &hash) const;
+    void ThreadWriteCoins();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
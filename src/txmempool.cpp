@@ -826,6 +826,20 @@ CTransactionRef CTxMemPool::get(const uint256& hash) const
     return i->GetSharedTx();
 }
 
+std::vector<TxMempoolRelayInfo> CTxMemPool::relayInfo(const std::vector<uint256>& vHashes) const
+{
+    LOCK(cs);
+    std::vector<TxMempoolRelayInfo> ret;
+    ret.reserve(vHashes.size());
+    for (const uint256& hash : vHashes) {
+        indexed_transaction_set::const_iterator it = mapTx.find(hash);
+        if (it == mapTx.end())
+            continue;
+        ret.push_back(TxMempoolRelayInfo{it->GetSharedTx(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetCountWithAncestors(), it->GetModifiedFee(), it->GetTxSize()});
+    }
+    return ret;
+}
+
 TxMempoolInfo CTxMemPool::info(const uint256& hash) const
 {
     LOCK(cs);
@@ -907,6 +921,32 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return base->GetCoin(outpoint, coin);
 }
 
+size_t CCoinsViewMemPool::GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const {
+    // Mempool entries win, as in GetCoin; the rest go to the base in one call.
+    size_t nFound = 0;
+    std::vector<COutPoint> vMissing;
+    std::vector<size_t> vMissingPos;
+    for (size_t i = 0; i < count; i++) {
+        CTransactionRef ptx = mempool.get(outpoints[i].hash);
+        if (!ptx) {
+            vMissing.push_back(outpoints[i]);
+            vMissingPos.push_back(i);
+        } else if (outpoints[i].n < ptx->vout.size()) {
+            coins[i] = Coin(ptx->vout[outpoints[i].n], MEMPOOL_HEIGHT, false);
+            nFound++;
+        } else {
+            coins[i].Clear();
+        }
+    }
+    if (vMissing.empty())
+        return nFound;
+    std::vector<Coin> vFetched(vMissing.size());
+    nFound += base->GetCoins(vMissing.data(), vFetched.data(), vMissing.size());
+    for (size_t j = 0; j < vMissing.size(); j++)
+        coins[vMissingPos[j]] = std::move(vFetched[j]);
+    return nFound;
+}
+
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
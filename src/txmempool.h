@@ -313,6 +313,25 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * What inventory relay orders and filters a mempool transaction by.
+ */
+struct TxMempoolRelayInfo
+{
+    /** The transaction itself */
+    CTransactionRef tx;
+
+    /** Feerate of the transaction. */
+    CFeeRate feeRate;
+
+    /** Number of in-mempool ancestors, including the transaction itself. */
+    uint64_t nCountWithAncestors;
+
+    /** Fee including the fee delta, and size, which give the mining score. */
+    CAmount nModFee;
+    size_t nTxSize;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -621,6 +640,8 @@ public:
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Relay info for each of vHashes that is in the mempool, looked up under one lock. */
+    std::vector<TxMempoolRelayInfo> relayInfo(const std::vector<uint256>& vHashes) const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -685,6 +706,7 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, const CTxMemPool& mempoolIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    size_t GetCoins(const COutPoint *outpoints, Coin *coins, size_t count) const override;
 };
 
 /**
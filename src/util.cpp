@@ -37,6 +37,8 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 
@@ -833,6 +835,20 @@ void RenameThread(const char* name)
 #endif
 }
 
+int ScheduleBatchPriority()
+{
+#ifdef SCHED_BATCH
+    const static sched_param param{0};
+    if (int ret = pthread_setschedparam(pthread_self(), SCHED_BATCH, &param)) {
+        LogPrintf("Failed to pthread_setschedparam: %s\n", strerror(ret));
+        return ret;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
 void SetupEnvironment()
 {
 #ifdef HAVE_MALLOPT_ARENA_MAX
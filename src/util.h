@@ -289,6 +289,14 @@ int GetNumCores();
 
 void RenameThread(const char* name);
 
+/**
+ * On platforms that support it, tell the kernel the calling thread is
+ * CPU-intensive and non-interactive, so it yields to latency-sensitive work.
+ * @return The return value of pthread_setschedparam(), or 1 on systems without
+ * SCHED_BATCH.
+ */
+int ScheduleBatchPriority();
+
 /**
  * .. and a wrapper that just calls func once
  */
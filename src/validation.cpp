@@ -6,14 +6,18 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "blockfilereader.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinstats.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
 #include "cuckoocache.h"
 #include "fs.h"
 #include "hash.h"
@@ -29,6 +33,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "timedata.h"
 #include "tinyformat.h"
 #include "txdb.h"
@@ -43,7 +48,9 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <deque>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -75,6 +82,7 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+int nCoinCacheRetain = DEFAULT_DBCACHE_RETAIN;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -87,6 +95,8 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 
 CBlockPolicyEstimator feeEstimator;
 CTxMemPool mempool(&feeEstimator);
+CBlockFileReader g_blockfilereader;
+CBlockCache g_blockcache;
 
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
 
@@ -1004,10 +1014,55 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/**
+ * Locate the record at pos in a block or undo file through a memory mapping.
+ * Records are preceded by the [message start][size] header that
+ * WriteBlockToDisk and UndoWriteToDisk write, which gives their length;
+ * nExtra more bytes that follow the record are included. Returns false if
+ * the record cannot be read this way, and the file has to be read instead.
+ */
+static bool GetMappedRecord(const CDiskBlockPos& pos, const char* prefix, size_t nExtra, std::shared_ptr<const CBlockFileMapping>& mapping, const char*& pbegin, const char*& pend)
+{
+    const size_t nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(uint32_t);
+    if (pos.IsNull() || pos.nPos < nHeaderSize)
+        return false;
+    const fs::path path = GetBlockPosFilename(pos, prefix);
+    mapping = g_blockfilereader.Map(path, pos.nPos);
+    if (!mapping)
+        return false;
+    const unsigned char* pheader = mapping->data() + pos.nPos - nHeaderSize;
+    if (memcmp(pheader, Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0)
+        return false;
+    const size_t nEnd = (size_t)pos.nPos + ReadLE32(pheader + CMessageHeader::MESSAGE_START_SIZE) + nExtra;
+    if (nEnd > mapping->size()) {
+        mapping = g_blockfilereader.Map(path, nEnd);
+        if (!mapping)
+            return false;
+    }
+    pbegin = (const char*)mapping->data() + pos.nPos;
+    pend = (const char*)mapping->data() + nEnd;
+    return true;
+}
+
+static bool ReadRawBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    // Deserialize straight from the mapped file where possible
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const char* pbegin;
+    const char* pend;
+    if (GetMappedRecord(pos, "blk", 0, mapping, pbegin, pend)) {
+        try {
+            CByteRangeReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1021,6 +1076,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadRawBlockFromDisk(block, pos))
+        return false;
+
     // Check the header
     if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
@@ -1028,13 +1091,29 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return true;
 }
 
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    std::shared_ptr<const CBlock> pblock = g_blockcache.Get(pindex->GetBlockHash());
+    if (pblock)
+        return pblock;
+    std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+        return nullptr;
+    g_blockcache.Insert(pindex->GetBlockHash(), pblockRead);
+    return pblockRead;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadRawBlockFromDisk(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    // The header is identical to the indexed one, so only entries whose proof of work was never
+    // checked (e.g. loaded from an older block index) need the scrypt hash.
+    if (!(pindex->nStatus & BLOCK_POW_VERIFIED) && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+        return error("ReadBlockFromDisk: Errors in block header at %s", pindex->GetBlockPos().ToString());
     return true;
 }
 
@@ -1375,6 +1454,27 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
+    // Verify and deserialize straight from the mapped file where possible
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const char* pbegin;
+    const char* pend;
+    if (GetMappedRecord(pos, "rev", sizeof(uint256), mapping, pbegin, pend)) {
+        const char* pchecksum = pend - sizeof(uint256);
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << hashBlock;
+        hasher.write(pbegin, pchecksum - pbegin);
+        if (memcmp(hasher.GetHash().begin(), pchecksum, sizeof(uint256)) != 0)
+            return error("%s: Checksum mismatch", __func__);
+        try {
+            CByteRangeReader reader(pbegin, pchecksum, SER_DISK, CLIENT_VERSION);
+            reader >> blockundo;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1530,6 +1630,12 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Mappings must not reach past the end of a truncated file.
+    if (fFinalize) {
+        g_blockfilereader.Invalidate(GetBlockPosFilename(posOld, "blk"));
+        g_blockfilereader.Invalidate(GetBlockPosFilename(posOld, "rev"));
+    }
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1556,6 +1662,29 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Each CPoWCheck already covers a run of headers, so workers take one at a time. */
+static CCheckQueue<CPoWCheck> powcheckqueue(1);
+
+void ThreadPoWCheck() {
+    RenameThread("herbsters-powcheck");
+    powcheckqueue.Thread();
+}
+
+static CCheckQueue<CTxDecodeCheck> txdecodequeue(16);
+
+void ThreadTxDecode() {
+    RenameThread("herbsters-txdecode");
+    txdecodequeue.Thread();
+}
+
+/** Each CCoinPrefetchCheck already covers a run of outpoints, so workers take one at a time. */
+static CCheckQueue<CCoinPrefetchCheck> coinprefetchqueue(1);
+
+void ThreadCoinPrefetch() {
+    RenameThread("herbsters-prefetch");
+    coinprefetchqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1959,9 +2088,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files. A coins write still running in the
+            // background may need them for replay after a crash, so wait for it.
+            if (fFlushForPrune) {
+                if (!pcoinsdbview->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -1974,7 +2107,18 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // When the flush is only due to the cache size, keep the most
+            // recently created coins cached instead of starting over cold.
+            // The coins database commits the flushed coins in the background;
+            // wait for that when asked to write everything now, or when block
+            // files were just pruned.
+            if ((fCacheLarge || fCacheCritical) && nCoinCacheRetain > 0) {
+                if (!pcoinsTip->PartialFlush(nTotalSpace / 100 * nCoinCacheRetain))
+                    return AbortNode(state, "Failed to write to coin database");
+            } else if (!pcoinsTip->Flush()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+            if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsdbview->Sync())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
@@ -2081,11 +2225,15 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
-    // Read block from disk.
-    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-    CBlock& block = *pblock;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
+    if (pindexDelete->nStatus & BLOCK_ASSUMED_VALID) {
+        // Neither the block nor its undo data were ever downloaded.
+        return state.Error(strprintf("cannot disconnect block %s, it was loaded from a UTXO snapshot", pindexDelete->GetBlockHash().ToString()));
+    }
+    // Read block from disk, unless it was connected or read recently.
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pindexDelete, chainparams.GetConsensus());
+    if (!pblock)
         return AbortNode(state, "Failed to read block");
+    const CBlock& block = *pblock;
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
@@ -2122,7 +2270,119 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     return true;
 }
 
+bool CCoinPrefetchCheck::operator()()
+{
+    try {
+        pview->GetCoins(poutpoints, pcoins, nCount);
+    } catch (const std::exception&) {
+        // Leave it to the regular lookup, which reports database errors.
+        for (size_t i = 0; i < nCount; i++)
+            pcoins[i].Clear();
+    }
+    return true;
+}
+
+/**
+ * Number of outpoints looked up by one CCoinPrefetchCheck. Each batch is
+ * read in key order with one database iterator, which favours larger ones.
+ */
+static const size_t COIN_PREFETCH_BATCH_SIZE = 64;
+
+/** Number of blocks past the one being connected that are read ahead during initial block download. */
+static const int COIN_PREFETCH_LOOKAHEAD = 8;
+
+/**
+ * Blocks towards pindexBestHeader that were read ahead of the tip during
+ * initial block download, and whose inputs have already been prefetched.
+ */
+std::deque<std::pair<const CBlockIndex*, std::shared_ptr<const CBlock>>> g_read_ahead_blocks;
+
+/**
+ * Look up the coins spent by the given blocks that are not in pcoinsTip yet
+ * in the coins database on the coin prefetch threads, and add them to
+ * pcoinsTip. Outputs created by the blocks themselves are skipped.
+ * This only warms the cache: whatever could not be read here is looked up
+ * again when the block is connected.
+ */
+static void PrefetchInputs(const std::vector<std::shared_ptr<const CBlock>>& vBlocks)
+{
+    AssertLockHeld(cs_main);
+
+    std::unordered_set<uint256, SaltedTxidHasher> setCreated;
+    for (const auto& pblock : vBlocks) {
+        for (const auto& tx : pblock->vtx)
+            setCreated.insert(tx->GetHash());
+    }
+    std::vector<COutPoint> vOutpoints;
+    for (const auto& pblock : vBlocks) {
+        for (const auto& tx : pblock->vtx) {
+            if (tx->IsCoinBase())
+                continue;
+            for (const CTxIn& txin : tx->vin) {
+                if (!setCreated.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                    vOutpoints.push_back(txin.prevout);
+            }
+        }
+    }
+    if (vOutpoints.empty())
+        return;
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::vector<CCoinPrefetchCheck> vChecks;
+    for (size_t i = 0; i < vOutpoints.size(); i += COIN_PREFETCH_BATCH_SIZE)
+        vChecks.emplace_back(pcoinsdbview, &vOutpoints[i], &vCoins[i], std::min(COIN_PREFETCH_BATCH_SIZE, vOutpoints.size() - i));
+    {
+        CCheckQueueControl<CCoinPrefetchCheck> control(&coinprefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+    for (size_t i = 0; i < vOutpoints.size(); i++)
+        pcoinsTip->CacheFetchedCoin(vOutpoints[i], std::move(vCoins[i]));
+}
+
+/**
+ * Prefetch the inputs of the block about to be connected at pindexNew.
+ * During initial block download the next blocks towards pindexBestHeader
+ * are read as well, and their inputs are fetched in the same batch.
+ */
+void PrefetchBlockInputs(const CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads || !pcoinsdbview)
+        return;
+
+    std::vector<std::shared_ptr<const CBlock>> vBlocks(1, pblock);
+    if (IsInitialBlockDownload() && pindexBestHeader && pindexBestHeader->GetAncestor(pindexNew->nHeight) == pindexNew) {
+        const int nLastHeight = std::min(pindexNew->nHeight + COIN_PREFETCH_LOOKAHEAD, pindexBestHeader->nHeight);
+        for (int nHeight = pindexNew->nHeight + 1; nHeight <= nLastHeight; nHeight++) {
+            const CBlockIndex* pindex = pindexBestHeader->GetAncestor(nHeight);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                break;
+            std::shared_ptr<CBlock> pblockAhead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockAhead, pindex, consensusParams))
+                break;
+            g_read_ahead_blocks.emplace_back(pindex, pblockAhead);
+            vBlocks.push_back(std::move(pblockAhead));
+        }
+    }
+    PrefetchInputs(vBlocks);
+}
+
+/** Return the block at pindex if it was read ahead, dropping read-ahead blocks before it or of another chain. */
+std::shared_ptr<const CBlock> TakeReadAheadBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    while (!g_read_ahead_blocks.empty()) {
+        std::pair<const CBlockIndex*, std::shared_ptr<const CBlock>> entry = std::move(g_read_ahead_blocks.front());
+        g_read_ahead_blocks.pop_front();
+        if (entry.first == pindex)
+            return entry.second;
+    }
+    return nullptr;
+}
+
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2204,20 +2464,28 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
+    std::shared_ptr<const CBlock> pblockReadAhead = TakeReadAheadBlock(pindexNew);
     std::shared_ptr<const CBlock> pthisBlock;
-    if (!pblock) {
+    if (pblock) {
+        pthisBlock = pblock;
+    } else if (pblockReadAhead) {
+        pthisBlock = pblockReadAhead;
+    } else {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
         pthisBlock = pblockNew;
-    } else {
-        pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
+    int64_t nTimeRead = GetTimeMicros(); nTimeReadFromDisk += nTimeRead - nTime1;
+    LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTimeRead - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    // Warm pcoinsTip with the block's inputs, unless that was done when it was read ahead.
+    if (!pblockReadAhead)
+        PrefetchBlockInputs(pindexNew, pthisBlock, chainparams.GetConsensus());
+    int64_t nTime2 = GetTimeMicros(); nTimePrefetch += nTime2 - nTimeRead;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2 - nTimeRead) * 0.001, nTimePrefetch * 0.000001);
     // Apply the block atomically to the chain state.
-    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
-    LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2249,6 +2517,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
 
+    // Peers and clients ask for a new tip block right away.
+    if (!IsInitialBlockDownload())
+        g_blockcache.Insert(pindexNew->GetBlockHash(), pthisBlock);
+
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
 }
@@ -2333,6 +2605,12 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     const CBlockIndex *pindexOldTip = chainActive.Tip();
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
+    // Blocks loaded from a UTXO snapshot cannot be disconnected; fail before
+    // disconnecting the ones above them.
+    if (pindexFork && pindexFork != chainActive.Tip() && (chainActive[pindexFork->nHeight + 1]->nStatus & BLOCK_ASSUMED_VALID)) {
+        return state.Error(strprintf("chain %s forks below the UTXO snapshot base block; restart with -reindex to follow it", pindexMostWork->GetBlockHash().ToString()));
+    }
+
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
     DisconnectedBlockTransactions disconnectpool;
@@ -2539,6 +2817,10 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
 {
     AssertLockHeld(cs_main);
 
+    if (pindex->nStatus & BLOCK_ASSUMED_VALID) {
+        return state.Error(strprintf("cannot invalidate block %s, it was loaded from a UTXO snapshot", pindex->GetBlockHash().ToString()));
+    }
+
     // We first disconnect backwards and then mark the blocks as invalid.
     // This prevents a case where pruned nodes may fail to invalidateblock
     // and be left unable to start as they have no tip candidates (as there
@@ -2656,6 +2938,8 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
+    // Callers have checked the header's proof of work, except for the hardcoded genesis block.
+    pindexNew->nStatus |= BLOCK_POW_VERIFIED;
     if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
 
@@ -2801,6 +3085,188 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
+bool CPoWCheck::operator()()
+{
+    std::vector<uint256> hashes(nCount);
+    GetPoWHashes(pheaders, nCount, hashes.data());
+    bool fOk = true;
+    for (size_t i = 0; i < nCount; i++) {
+        presults[i] = CheckProofOfWork(hashes[i], pheaders[i].nBits, *params) ? VALID : INVALID;
+        fOk &= presults[i] == VALID;
+    }
+    return fOk;
+}
+
+/** Number of headers hashed by one CPoWCheck: a few passes of the widest scrypt kernel. */
+static const size_t POW_CHECK_BATCH_SIZE = 32;
+
+/**
+ * Check the proof of work of all not yet known headers in a batch on the
+ * PoW-check threads, without holding cs_main during the hashing. The first
+ * new header is checked on its own first, so that a batch of junk is
+ * rejected after a single hash.
+ * Returns a CPoWCheck::Result for each header; known headers, and headers
+ * skipped after a failure, are left UNCHECKED.
+ */
+static std::vector<unsigned char> CheckHeadersProofOfWork(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams)
+{
+    std::vector<unsigned char> vResults(headers.size(), CPoWCheck::UNCHECKED);
+    std::vector<CBlockHeader> vNew;
+    std::vector<size_t> vNewPos;
+    vNew.reserve(headers.size());
+    vNewPos.reserve(headers.size());
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (!mapBlockIndex.count(headers[i].GetHash())) {
+                vNew.push_back(headers[i]);
+                vNewPos.push_back(i);
+            }
+        }
+    }
+    if (vNew.empty())
+        return vResults;
+
+    std::vector<unsigned char> vNewResults(vNew.size(), CPoWCheck::UNCHECKED);
+    if (CPoWCheck(&vNew[0], 1, consensusParams, &vNewResults[0])()) {
+        std::vector<CPoWCheck> vChecks;
+        for (size_t i = 1; i < vNew.size(); i += POW_CHECK_BATCH_SIZE)
+            vChecks.emplace_back(&vNew[i], std::min(POW_CHECK_BATCH_SIZE, vNew.size() - i), consensusParams, &vNewResults[i]);
+
+        if (!nScriptCheckThreads) {
+            for (CPoWCheck& check : vChecks) {
+                if (!check())
+                    break;
+            }
+        } else {
+            CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+        }
+    }
+
+    for (size_t i = 0; i < vNew.size(); i++)
+        vResults[vNewPos[i]] = vNewResults[i];
+    return vResults;
+}
+
+static uint64_t SkipTxInputs(CByteRangeReader& s)
+{
+    const uint64_t nInputs = ReadCompactSize(s);
+    for (uint64_t i = 0; i < nInputs; i++) {
+        s.ignore(32 + 4);               // prevout
+        s.ignore(ReadCompactSize(s));   // scriptSig
+        s.ignore(4);                    // nSequence
+    }
+    return nInputs;
+}
+
+static void SkipTxOutputs(CByteRangeReader& s)
+{
+    const uint64_t nOutputs = ReadCompactSize(s);
+    for (uint64_t i = 0; i < nOutputs; i++) {
+        s.ignore(8);                    // nValue
+        s.ignore(ReadCompactSize(s));   // scriptPubKey
+    }
+}
+
+/** Advance s past one transaction, following the same rules as UnserializeTransaction. */
+static void SkipTransaction(CByteRangeReader& s)
+{
+    const bool fAllowWitness = !(s.GetVersion() & SERIALIZE_TRANSACTION_NO_WITNESS);
+
+    s.ignore(4); // nVersion
+    unsigned char flags = 0;
+    uint64_t nInputs = SkipTxInputs(s);
+    if (nInputs == 0 && fAllowWitness) {
+        /* We read a dummy or an empty vin. */
+        s >> flags;
+        if (flags != 0) {
+            nInputs = SkipTxInputs(s);
+            SkipTxOutputs(s);
+        }
+    } else {
+        /* We read a non-empty vin. Assume a normal vout follows. */
+        SkipTxOutputs(s);
+    }
+    if ((flags & 1) && fAllowWitness) {
+        /* The witness flag is present, and we support witnesses. */
+        flags ^= 1;
+        for (uint64_t i = 0; i < nInputs; i++) {
+            const uint64_t nItems = ReadCompactSize(s);
+            for (uint64_t j = 0; j < nItems; j++)
+                s.ignore(ReadCompactSize(s));
+        }
+    }
+    if (flags) {
+        /* Unknown flag in the serialization */
+        throw std::ios_base::failure("Unknown transaction optional data");
+    }
+    s.ignore(4); // nLockTime
+}
+
+bool CTxDecodeCheck::operator()()
+{
+    try {
+        CByteRangeReader s(pbegin, pend, nType, nVersion);
+        *ptx = std::make_shared<const CTransaction>(deserialize, s);
+        return s.size() == 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+/** Below this many transactions a block is decoded on the calling thread. */
+static const uint64_t TX_DECODE_PARALLEL_MIN = 64;
+
+void DeserializeTransactionsParallel(CDataStream& s, std::vector<CTransactionRef>& vtx)
+{
+    const uint64_t nTx = ReadCompactSize(s);
+
+    // Find where each transaction starts. Every transaction takes at least
+    // ten bytes, which bounds the reservation for a bogus count.
+    CByteRangeReader scan(s.data(), s.data() + s.size(), s.GetType(), s.GetVersion());
+    std::vector<const char*> vBounds;
+    vBounds.reserve(std::min<uint64_t>(nTx, s.size() / 10) + 1);
+    vBounds.push_back(scan.data());
+    for (uint64_t i = 0; i < nTx; i++) {
+        SkipTransaction(scan);
+        vBounds.push_back(scan.data());
+    }
+
+    vtx.clear();
+    vtx.resize(nTx);
+    std::vector<CTxDecodeCheck> vChecks;
+    vChecks.reserve(nTx);
+    for (uint64_t i = 0; i < nTx; i++)
+        vChecks.emplace_back(vBounds[i], vBounds[i + 1], s.GetType(), s.GetVersion(), &vtx[i]);
+
+    bool fOk = true;
+    if (!nScriptCheckThreads || nTx < TX_DECODE_PARALLEL_MIN) {
+        for (CTxDecodeCheck& check : vChecks) {
+            if (!check()) {
+                fOk = false;
+                break;
+            }
+        }
+    } else {
+        CCheckQueueControl<CTxDecodeCheck> control(&txdecodequeue);
+        control.Add(vChecks);
+        fOk = control.Wait();
+    }
+    if (!fOk)
+        throw std::ios_base::failure("DeserializeTransactionsParallel(): invalid transaction");
+
+    s.ignore(vBounds.back() - vBounds.front());
+}
+
+void DeserializeBlockParallel(CDataStream& s, CBlock& block)
+{
+    block.SetNull();
+    s >> *(CBlockHeader*)&block;
+    DeserializeTransactionsParallel(s, block.vtx);
+}
+
 static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
     // Check proof of work matches claimed amount
@@ -3062,7 +3528,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3081,7 +3547,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3125,11 +3591,20 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+    // Hash the batch in parallel up front. Headers it did not get to are
+    // checked one by one below, which only happens after a failure.
+    std::vector<unsigned char> vPoW = CheckHeadersProofOfWork(headers, chainparams.GetConsensus());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (vPoW[i] == CPoWCheck::INVALID) {
+                state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+                if (first_invalid) *first_invalid = header;
+                return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, header.GetHash().ToString(), FormatStateMessage(state));
+            }
+            if (!AcceptBlockHeader(header, state, chainparams, &pindex, vPoW[i] != CPoWCheck::VALID)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3334,6 +3809,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_blockfilereader.Invalidate(GetBlockPosFilename(pos, "blk"));
+        g_blockfilereader.Invalidate(GetBlockPosFilename(pos, "rev"));
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3670,8 +4147,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if ((fPruneMode || (pindex->nStatus & BLOCK_ASSUMED_VALID)) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning or loaded from a UTXO snapshot, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -3931,6 +4408,7 @@ void UnloadBlockIndex()
     setDirtyBlockIndex.clear();
     g_failed_blocks.clear();
     setDirtyFileInfo.clear();
+    g_read_ahead_blocks.clear();
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
@@ -3968,6 +4446,105 @@ bool LoadBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/** Entries hashed per step of a -verifyindexpow thread */
+static const size_t INDEX_POW_BATCH_SIZE = 64;
+
+static std::vector<CBlockIndex*> vIndexPoWToVerify;
+static std::atomic<size_t> nIndexPoWNext{0};
+static std::atomic<size_t> nIndexPoWChecked{0};
+static std::atomic<int> nIndexPoWWorkers{0};
+static std::atomic<bool> fIndexPoWStarted{false};
+static std::atomic<bool> fIndexPoWDone{false};
+static std::atomic<bool> fIndexPoWFailed{false};
+static CCriticalSection cs_indexpow;
+static uint256 hashIndexPoWFailed; // protected by cs_indexpow
+
+const CBlockIndex* CheckBlockIndexPoW(const CBlockIndex* const* ppindex, size_t nCount, const Consensus::Params& consensusParams)
+{
+    // Header fields of an index entry never change once it is created, so no cs_main is needed.
+    std::vector<CBlockHeader> headers;
+    headers.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++)
+        headers.push_back(ppindex[i]->GetBlockHeader());
+    std::vector<unsigned char> results(nCount, CPoWCheck::UNCHECKED);
+    if (CPoWCheck(headers.data(), nCount, consensusParams, results.data())())
+        return nullptr;
+    return ppindex[std::find(results.begin(), results.end(), CPoWCheck::INVALID) - results.begin()];
+}
+
+static void ThreadVerifyIndexPoW(const Consensus::Params& consensusParams)
+{
+    ScheduleBatchPriority();
+    while (!fIndexPoWFailed) {
+        boost::this_thread::interruption_point();
+        size_t nBegin = nIndexPoWNext.fetch_add(INDEX_POW_BATCH_SIZE);
+        if (nBegin >= vIndexPoWToVerify.size())
+            break;
+        size_t nEnd = std::min(nBegin + INDEX_POW_BATCH_SIZE, vIndexPoWToVerify.size());
+
+        const CBlockIndex* pindexFailed = CheckBlockIndexPoW(&vIndexPoWToVerify[nBegin], nEnd - nBegin, consensusParams);
+        if (pindexFailed) {
+            if (fIndexPoWFailed.exchange(true))
+                return;
+            uint256 hash = pindexFailed->GetBlockHash();
+            {
+                LOCK(cs_indexpow);
+                hashIndexPoWFailed = hash;
+            }
+            AbortNode(strprintf("verifyindexpow: proof of work failed for block index entry %s", hash.ToString()),
+                      _("Corrupted block index detected: a block header does not satisfy its proof of work. Please restart with -reindex."));
+            return;
+        }
+        nIndexPoWChecked += nEnd - nBegin;
+    }
+
+    // The last thread to finish records the result, so later reads of these blocks can skip the scrypt hash.
+    if (--nIndexPoWWorkers == 0 && !fIndexPoWFailed) {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex : vIndexPoWToVerify) {
+            if (!(pindex->nStatus & BLOCK_POW_VERIFIED)) {
+                pindex->nStatus |= BLOCK_POW_VERIFIED;
+                setDirtyBlockIndex.insert(pindex);
+            }
+        }
+        fIndexPoWDone = true;
+        LogPrintf("verifyindexpow: proof of work of %u block index entries verified\n", vIndexPoWToVerify.size());
+    }
+}
+
+void StartVerifyIndexPoW(boost::thread_group& threadGroup, int nThreads, const Consensus::Params& consensusParams)
+{
+    assert(!fIndexPoWStarted);
+    {
+        LOCK(cs_main);
+        vIndexPoWToVerify.reserve(mapBlockIndex.size());
+        for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
+            // The genesis block is hardcoded rather than loaded
+            if (item.second->pprev != nullptr)
+                vIndexPoWToVerify.push_back(item.second);
+        }
+    }
+    LogPrintf("verifyindexpow: checking proof of work of %u block index entries on %d threads\n", vIndexPoWToVerify.size(), nThreads);
+    fIndexPoWStarted = true;
+    nIndexPoWWorkers = nThreads;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "powverify", boost::function<void()>(boost::bind(&ThreadVerifyIndexPoW, boost::cref(consensusParams)))));
+}
+
+IndexPoWVerifyStatus GetIndexPoWVerifyStatus()
+{
+    IndexPoWVerifyStatus status;
+    status.fStarted = fIndexPoWStarted;
+    status.fDone = fIndexPoWDone;
+    status.nTotal = fIndexPoWStarted ? vIndexPoWToVerify.size() : 0;
+    status.nChecked = nIndexPoWChecked;
+    {
+        LOCK(cs_indexpow);
+        status.hashFailed = hashIndexPoWFailed;
+    }
+    return status;
+}
+
 bool LoadGenesisBlock(const CChainParams& chainparams)
 {
     LOCK(cs_main);
@@ -4010,6 +4587,8 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
+        // Raw bytes of the current block, decoded with DeserializeBlockParallel
+        CDataStream blockdata(SER_DISK, CLIENT_VERSION);
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
 
@@ -4040,10 +4619,13 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
+                blockdata.clear();
+                blockdata.resize(nSize);
+                blkdat.read(blockdata.data(), nSize);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                DeserializeBlockParallel(blockdata, block);
+                nRewind = nBlockPos + (nSize - blockdata.size());
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -4157,6 +4739,8 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    // A chain loaded from a UTXO snapshot lacks the data of its first blocks, just like a pruned one.
+    const bool fMissingData = fHavePruned || (chainActive.Height() > 0 && (chainActive[1]->nStatus & BLOCK_ASSUMED_VALID));
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
@@ -4176,7 +4760,7 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId <= 0);  // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        if (!fMissingData) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -4235,7 +4819,7 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstMissing == nullptr) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fMissingData); // We must have pruned.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -4443,6 +5027,476 @@ void DumpMempool(void)
     }
 }
 
+static const uint16_t TXOUTSET_SNAPSHOT_VERSION = 2;
+static const unsigned char TXOUTSET_SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+
+/**
+ * Header of a UTXO set snapshot written by DumpTxOutSet. It is followed by
+ * the headers of the chain up to the base block (each with its transaction
+ * count), the headers of the blocks that bury the base block, the coins
+ * grouped by txid and terminated by a null txid, and the coin count and
+ * serialized hash of the whole set (hash_serialized_2 in gettxoutsetinfo),
+ * which LoadTxOutSet checks before using any of it.
+ */
+class CTxOutSetSnapshotHeader
+{
+public:
+    unsigned char pchMagic[5];
+    uint16_t nVersion;
+    unsigned char pchMessageStart[CMessageHeader::MESSAGE_START_SIZE];
+    uint256 hashBlock;
+    uint32_t nHeight;
+
+    CTxOutSetSnapshotHeader() : nVersion(0), nHeight(0)
+    {
+        memset(pchMagic, 0, sizeof(pchMagic));
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    CTxOutSetSnapshotHeader(const CChainParams& chainparams, const CBlockIndex* pindex) :
+        nVersion(TXOUTSET_SNAPSHOT_VERSION), hashBlock(pindex->GetBlockHash()), nHeight(pindex->nHeight)
+    {
+        memcpy(pchMagic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(pchMagic));
+        memcpy(pchMessageStart, chainparams.MessageStart(), sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
+static void WriteTxOutSetOutputs(CAutoFile& file, CCoinsStats& stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    file << hash;
+    WriteCompactSize(file, outputs.size());
+    for (const auto& output : outputs) {
+        file << VARINT(output.first);
+        file << output.second;
+    }
+    ApplyStats(stats, ss, hash, outputs);
+}
+
+bool DumpTxOutSet(const fs::path& path, CCoinsStats& stats, std::string& strError)
+{
+    const CChainParams& chainparams = Params();
+    int64_t nStart = GetTimeMicros();
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::vector<const CBlockIndex*> vChain;
+    std::vector<CBlockHeader> vHeadersAfterBase;
+    // Coins that differ between the tip and the base block: spent ones were
+    // created by the blocks on top of the base.
+    std::map<COutPoint, Coin> mapRollback;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        // The cursor reads from a database snapshot, so the tip may move on
+        // while the coins are written.
+        pcursor.reset(pcoinsdbview->Cursor());
+        const CBlockIndex* pindexTip = mapBlockIndex.find(pcursor->GetBestBlock())->second;
+        // A snapshot is taken below the tip, so that a reorganization
+        // across its base is unlikely.
+        if (pindexTip->nHeight <= TXOUTSET_SNAPSHOT_DEPTH) {
+            strError = strprintf("the chain has to be more than %d blocks long", TXOUTSET_SNAPSHOT_DEPTH);
+            return false;
+        }
+        const CBlockIndex* pindexBase = pindexTip->GetAncestor(pindexTip->nHeight - TXOUTSET_SNAPSHOT_DEPTH);
+
+        // Roll the coins back to the base block in memory.
+        CCoinsViewCache viewRollback(pcoinsTip);
+        std::set<COutPoint> setTouched;
+        for (const CBlockIndex* pindex = pindexTip; pindex != pindexBase; pindex = pindex->pprev) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()) ||
+                DisconnectBlock(block, pindex, viewRollback) != DISCONNECT_OK) {
+                strError = strprintf("unable to roll back block %s", pindex->GetBlockHash().ToString());
+                return false;
+            }
+            for (const CTransactionRef& tx : block.vtx) {
+                for (size_t i = 0; i < tx->vout.size(); i++) {
+                    setTouched.insert(COutPoint(tx->GetHash(), i));
+                }
+                if (!tx->IsCoinBase()) {
+                    for (const CTxIn& txin : tx->vin) {
+                        setTouched.insert(txin.prevout);
+                    }
+                }
+            }
+            vHeadersAfterBase.push_back(pindex->GetBlockHeader());
+        }
+        std::reverse(vHeadersAfterBase.begin(), vHeadersAfterBase.end());
+        for (const COutPoint& outpoint : setTouched) {
+            Coin coin;
+            viewRollback.GetCoin(outpoint, coin);
+            mapRollback.emplace(outpoint, std::move(coin));
+        }
+
+        stats.hashBlock = pindexBase->GetBlockHash();
+        stats.nHeight = pindexBase->nHeight;
+        vChain.resize(pindexBase->nHeight);
+        for (const CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+            vChain[pindex->nHeight - 1] = pindex;
+        }
+    }
+
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    try {
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            strError = strprintf("unable to open %s for writing", pathTmp.string());
+            return false;
+        }
+
+        file << CTxOutSetSnapshotHeader(chainparams, vChain.back());
+        for (const CBlockIndex* pindex : vChain) {
+            // Headers and nTx of blocks in the chain do not change, so
+            // these are safe to read without cs_main.
+            file << pindex->GetBlockHeader();
+            file << VARINT(pindex->nTx);
+        }
+        file << vHeadersAfterBase;
+
+        // Merge the coins at the tip with the rolled back ones, one txid at
+        // a time, in the order of the database.
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << stats.hashBlock;
+        std::map<COutPoint, Coin>::iterator itRollback = mapRollback.begin();
+        COutPoint key;
+        bool fHaveKey = false;
+        while (true) {
+            boost::this_thread::interruption_point();
+            if (!fHaveKey && pcursor->Valid()) {
+                if (!pcursor->GetKey(key)) {
+                    strError = "unable to read the UTXO set";
+                    return false;
+                }
+                fHaveKey = true;
+            }
+            if (!fHaveKey && itRollback == mapRollback.end()) {
+                break;
+            }
+            uint256 hash;
+            if (!fHaveKey || (itRollback != mapRollback.end() && itRollback->first.hash < key.hash)) {
+                hash = itRollback->first.hash;
+            } else {
+                hash = key.hash;
+            }
+            std::map<uint32_t, Coin> outputs;
+            while (fHaveKey && key.hash == hash) {
+                Coin coin;
+                if (!pcursor->GetValue(coin)) {
+                    strError = "unable to read the UTXO set";
+                    return false;
+                }
+                outputs[key.n] = std::move(coin);
+                pcursor->Next();
+                fHaveKey = pcursor->Valid() && pcursor->GetKey(key);
+            }
+            for (; itRollback != mapRollback.end() && itRollback->first.hash == hash; ++itRollback) {
+                if (itRollback->second.IsSpent()) {
+                    outputs.erase(itRollback->first.n);
+                } else {
+                    outputs[itRollback->first.n] = std::move(itRollback->second);
+                }
+            }
+            if (!outputs.empty()) {
+                WriteTxOutSetOutputs(file, stats, ss, hash, outputs);
+            }
+        }
+        stats.hashSerialized = ss.GetHash();
+
+        file << uint256();
+        file << stats.nTransactionOutputs;
+        file << stats.hashSerialized;
+        FileCommit(file.Get());
+        file.fclose();
+    } catch (const std::exception& e) {
+        strError = strprintf("failed to write %s: %s", pathTmp.string(), e.what());
+        return false;
+    }
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("unable to rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+
+    LogPrintf("Dumped UTXO set at height %d (%s): %u coins in %.2fs\n", stats.nHeight, stats.hashBlock.ToString(),
+        stats.nTransactionOutputs, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+/**
+ * Read the coins section of a snapshot, recomputing its statistics and
+ * serialized hash, and pass every coin to fn. Throws on malformed data.
+ */
+template <typename Callable>
+static void ReadTxOutSetCoins(CAutoFile& file, CCoinsStats& stats, Callable fn)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    uint256 prevkey;
+    while (true) {
+        uint256 hash;
+        file >> hash;
+        if (hash.IsNull()) {
+            break;
+        }
+        // The cursor returns coins in key order; anything else means the
+        // file was not written by DumpTxOutSet.
+        if (!prevkey.IsNull() && !(prevkey < hash)) {
+            throw std::ios_base::failure("coins are not sorted by txid");
+        }
+        prevkey = hash;
+        uint64_t nOutputs = ReadCompactSize(file);
+        if (nOutputs == 0) {
+            throw std::ios_base::failure("transaction without outputs");
+        }
+        std::map<uint32_t, Coin> outputs;
+        for (uint64_t i = 0; i < nOutputs; i++) {
+            uint32_t n;
+            Coin coin;
+            file >> VARINT(n);
+            file >> coin;
+            if (coin.IsSpent() || !outputs.emplace(n, std::move(coin)).second) {
+                throw std::ios_base::failure("invalid output");
+            }
+        }
+        ApplyStats(stats, ss, hash, outputs);
+        for (auto& output : outputs) {
+            fn(COutPoint(hash, output.first), std::move(output.second));
+        }
+        if (ShutdownRequested()) {
+            throw std::runtime_error("shutdown requested");
+        }
+    }
+    stats.hashSerialized = ss.GetHash();
+}
+
+bool LoadTxOutSet(const CChainParams& chainparams, const fs::path& path, const uint256& hashBlockExpected, const uint256& hashSerializedExpected, std::string& strError)
+{
+    int64_t nStart = GetTimeMicros();
+
+    {
+        LOCK(cs_main);
+        const uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+        if (!hashBestBlock.IsNull() && hashBestBlock != chainparams.GetConsensus().hashGenesisBlock) {
+            strError = "the chainstate is past the genesis block";
+            return false;
+        }
+    }
+
+    // Connect the genesis block, so that there is an active chain to attach
+    // the snapshot's headers to.
+    {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            strError = FormatStateMessage(state);
+            return false;
+        }
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        strError = "the chainstate is past the genesis block";
+        return false;
+    }
+    if (fTxIndex) {
+        strError = "a snapshot cannot be loaded with -txindex";
+        return false;
+    }
+
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("unable to open %s", path.string());
+        return false;
+    }
+
+    CBlockIndex* pindexBase = nullptr;
+    std::vector<unsigned int> vTx;
+    CCoinsStats stats;
+    try {
+        CTxOutSetSnapshotHeader header;
+        file >> header;
+        if (memcmp(header.pchMagic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(header.pchMagic)) ||
+            header.nVersion != TXOUTSET_SNAPSHOT_VERSION) {
+            strError = "not a UTXO snapshot, or an unsupported version";
+            return false;
+        }
+        if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart))) {
+            strError = "the snapshot is for a different network";
+            return false;
+        }
+        if (header.hashBlock != hashBlockExpected) {
+            strError = strprintf("the snapshot is of block %s, not the expected %s", header.hashBlock.ToString(), hashBlockExpected.ToString());
+            return false;
+        }
+        if (header.nHeight == 0) {
+            strError = "the snapshot has no blocks beyond genesis";
+            return false;
+        }
+        stats.hashBlock = header.hashBlock;
+        stats.nHeight = header.nHeight;
+
+        // The headers go through the same checks as headers from the
+        // network, which ties the coins to a chain with valid proof of work.
+        vTx.reserve(header.nHeight);
+        std::vector<CBlockHeader> headers;
+        headers.reserve(MAX_HEADERS_RESULTS);
+        for (uint32_t i = 0; i < header.nHeight; i++) {
+            headers.emplace_back();
+            file >> headers.back();
+            unsigned int nTx;
+            file >> VARINT(nTx);
+            if (nTx == 0) {
+                throw std::ios_base::failure("block without transactions");
+            }
+            vTx.push_back(nTx);
+            if (headers.size() == MAX_HEADERS_RESULTS || i + 1 == header.nHeight) {
+                CValidationState state;
+                if (!ProcessNewBlockHeaders(headers, state, chainparams)) {
+                    strError = strprintf("invalid block header: %s", FormatStateMessage(state));
+                    return false;
+                }
+                headers.clear();
+            }
+        }
+        BlockMap::iterator it = mapBlockIndex.find(header.hashBlock);
+        if (it == mapBlockIndex.end() || it->second->nHeight != (int)header.nHeight) {
+            strError = "the headers do not lead to the snapshot base block";
+            return false;
+        }
+        pindexBase = it->second;
+        if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+            strError = "the snapshot base block is invalid";
+            return false;
+        }
+
+        // The blocks up to the base cannot be disconnected later, so the base
+        // has to be buried in the best header chain.
+        std::vector<CBlockHeader> vHeadersAfterBase;
+        file >> vHeadersAfterBase;
+        if (vHeadersAfterBase.size() > MAX_HEADERS_RESULTS) {
+            throw std::ios_base::failure("too many headers after the base block");
+        }
+        if (!vHeadersAfterBase.empty()) {
+            CValidationState state;
+            if (!ProcessNewBlockHeaders(vHeadersAfterBase, state, chainparams)) {
+                strError = strprintf("invalid block header: %s", FormatStateMessage(state));
+                return false;
+            }
+        }
+        if (pindexBestHeader->GetAncestor(pindexBase->nHeight) != pindexBase ||
+            pindexBestHeader->nHeight - pindexBase->nHeight < TXOUTSET_SNAPSHOT_DEPTH) {
+            strError = strprintf("the snapshot base block is not buried under %d headers of the best chain", TXOUTSET_SNAPSHOT_DEPTH);
+            return false;
+        }
+
+        // Verify the whole set before writing any of it to the chainstate.
+        long nCoinsPos = ftell(file.Get());
+        ReadTxOutSetCoins(file, stats, [](const COutPoint&, Coin&&) {});
+        uint64_t nCoins;
+        uint256 hashSerialized;
+        file >> nCoins;
+        file >> hashSerialized;
+        if (nCoins != stats.nTransactionOutputs || hashSerialized != stats.hashSerialized) {
+            strError = "the snapshot is corrupt (coin count or hash mismatch)";
+            return false;
+        }
+        // The trailer was written along with the coins; only the expected
+        // hash ties them to the UTXO set of the actual chain.
+        if (stats.hashSerialized != hashSerializedExpected) {
+            strError = strprintf("the UTXO set hash %s does not match the expected %s", stats.hashSerialized.ToString(), hashSerializedExpected.ToString());
+            return false;
+        }
+        LogPrintf("%s: snapshot of %u coins at height %d (%s), hash_serialized_2=%s\n", __func__,
+            nCoins, stats.nHeight, stats.hashBlock.ToString(), stats.hashSerialized.ToString());
+
+        // Mark the load as in progress: the coins are flushed to disk in
+        // batches, and an interrupted load leaves an incomplete set behind.
+        // The flag has to be on disk before the first of those batches.
+        if (!pblocktree->WriteFlag("txoutsetloading", true) || !pblocktree->Sync()) {
+            strError = "unable to write to the block index database";
+            return false;
+        }
+        if (fseek(file.Get(), nCoinsPos, SEEK_SET) != 0) {
+            throw std::ios_base::failure("unable to seek");
+        }
+        CCoinsStats statsLoaded;
+        statsLoaded.hashBlock = stats.hashBlock;
+        ReadTxOutSetCoins(file, statsLoaded, [&](const COutPoint& outpoint, Coin&& coin) {
+            pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) {
+                pcoinsTip->SetBestBlock(stats.hashBlock);
+                if (!pcoinsTip->Flush()) {
+                    throw std::runtime_error("failed to write the chainstate");
+                }
+            }
+        });
+        if (statsLoaded.hashSerialized != stats.hashSerialized) {
+            strError = "the snapshot changed while it was loaded";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("failed to read %s: %s", path.string(), e.what());
+        return false;
+    }
+
+    // The blocks up to the base are treated like pruned ones: transactions
+    // counted and fully valid, but without data.
+    for (CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            pindex->nTx = vTx[pindex->nHeight - 1];
+        }
+        pindex->nStatus |= BLOCK_ASSUMED_VALID | BLOCK_OPT_WITNESS;
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+    for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++) {
+        CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+    }
+    setBlockIndexCandidates.insert(pindexBase);
+
+    pcoinsTip->SetBestBlock(stats.hashBlock);
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS)) {
+        strError = FormatStateMessage(state);
+        return false;
+    }
+    if (!pblocktree->WriteFlag("txoutsetloading", false) || !pblocktree->Sync()) {
+        strError = "unable to write to the block index database";
+        return false;
+    }
+    if (!LoadChainTip(chainparams)) {
+        strError = "unable to activate the snapshot base block";
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot: %u coins in %.2fs\n", stats.nTransactionOutputs, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool HaveAssumedValidBlocksWithoutData()
+{
+    LOCK(cs_main);
+    // The blocks of a snapshot are the first ones of the chain.
+    for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (!(pindex->nStatus & BLOCK_ASSUMED_VALID))
+            return false;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            return true;
+    }
+    return false;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, CBlockIndex *pindex) {
     if (pindex == nullptr)
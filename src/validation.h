@@ -30,21 +30,29 @@
 
 #include <atomic>
 
+class CBlockCache;
+class CBlockFileReader;
 class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
+class CDataStream;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+struct CCoinsStats;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
 
+namespace boost {
+class thread_group;
+} // namespace boost
+
 /** Default for DEFAULT_WHITELISTRELAY. */
 static const bool DEFAULT_WHITELISTRELAY = true;
 /** Default for DEFAULT_WHITELISTFORCERELAY. */
@@ -130,6 +138,7 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = false;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_VERIFYINDEXPOW = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
@@ -158,6 +167,10 @@ extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
+/** Memory mappings that block and undo data is read through */
+extern CBlockFileReader g_blockfilereader;
+/** Recently connected, read or served blocks */
+extern CBlockCache g_blockcache;
 typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -174,6 +187,8 @@ extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Percentage of nCoinCacheUsage kept cached after a flush caused by the cache size. */
+extern int nCoinCacheRetain;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -203,6 +218,13 @@ extern bool fPruneMode;
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Number of blocks on top of its base block that a UTXO snapshot is dumped with, and has to have to be loaded */
+static const int TXOUTSET_SNAPSHOT_DEPTH = 10;
+
+/** Default for -dbcacheretain */
+static const int DEFAULT_DBCACHE_RETAIN = 50;
+/** Maximum for -dbcacheretain; the retained coins have to leave room for new ones. */
+static const int MAX_DBCACHE_RETAIN = 75;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6 * 4;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
@@ -270,6 +292,28 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Run an instance of the transaction decoding thread */
+void ThreadTxDecode();
+/** Run an instance of the coin prefetching thread */
+void ThreadCoinPrefetch();
+
+/** Progress of the background -verifyindexpow check */
+struct IndexPoWVerifyStatus
+{
+    bool fStarted;      //!< a check was started
+    bool fDone;         //!< every entry was checked and passed
+    size_t nTotal;      //!< number of block index entries to check
+    size_t nChecked;    //!< number of entries checked so far
+    uint256 hashFailed; //!< first entry found with invalid proof of work, null if none
+};
+/** Check the proof of work of nCount block index entries. Returns the first entry that fails, or nullptr if all pass. */
+const CBlockIndex* CheckBlockIndexPoW(const CBlockIndex* const* ppindex, size_t nCount, const Consensus::Params& consensusParams);
+/** Re-verify the proof of work of every loaded block index entry on nThreads low-priority threads. Aborts the node on a mismatch. */
+void StartVerifyIndexPoW(boost::thread_group& threadGroup, int nThreads, const Consensus::Params& consensusParams);
+/** Return the current progress of the background -verifyindexpow check */
+IndexPoWVerifyStatus GetIndexPoWVerifyStatus();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -389,6 +433,106 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof-of-work check of a run of block headers
+ * Note that this stores pointers into the caller's headers and result vector
+ */
+class CPoWCheck
+{
+public:
+    //! Outcome of the check of one header
+    enum Result : unsigned char { UNCHECKED = 0, VALID, INVALID };
+
+private:
+    const CBlockHeader *pheaders;
+    size_t nCount;
+    const Consensus::Params *params;
+    unsigned char *presults;
+
+public:
+    CPoWCheck(): pheaders(nullptr), nCount(0), params(nullptr), presults(nullptr) {}
+    CPoWCheck(const CBlockHeader* pheadersIn, size_t nCountIn, const Consensus::Params& paramsIn, unsigned char* presultsIn) :
+        pheaders(pheadersIn), nCount(nCountIn), params(&paramsIn), presults(presultsIn) { }
+
+    bool operator()();
+
+    void swap(CPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nCount, check.nCount);
+        std::swap(params, check.params);
+        std::swap(presults, check.presults);
+    }
+};
+
+/**
+ * Closure representing the deserialization (and hashing) of one transaction
+ * from a byte range of a serialized block.
+ * Note that this stores pointers into the caller's stream and result vector
+ */
+class CTxDecodeCheck
+{
+private:
+    const char *pbegin;
+    const char *pend;
+    int nType;
+    int nVersion;
+    CTransactionRef *ptx;
+
+public:
+    CTxDecodeCheck(): pbegin(nullptr), pend(nullptr), nType(0), nVersion(0), ptx(nullptr) {}
+    CTxDecodeCheck(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn, CTransactionRef* ptxIn) :
+        pbegin(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn), ptx(ptxIn) { }
+
+    bool operator()();
+
+    void swap(CTxDecodeCheck &check) {
+        std::swap(pbegin, check.pbegin);
+        std::swap(pend, check.pend);
+        std::swap(nType, check.nType);
+        std::swap(nVersion, check.nVersion);
+        std::swap(ptx, check.ptx);
+    }
+};
+
+/**
+ * Closure representing the database lookup of a run of outpoints ahead of
+ * block validation. Coins that are not found are left spent.
+ * Note that this stores pointers into the caller's outpoint and coin vectors
+ */
+class CCoinPrefetchCheck
+{
+private:
+    CCoinsView *pview;
+    const COutPoint *poutpoints;
+    Coin *pcoins;
+    size_t nCount;
+
+public:
+    CCoinPrefetchCheck(): pview(nullptr), poutpoints(nullptr), pcoins(nullptr), nCount(0) {}
+    CCoinPrefetchCheck(CCoinsView* pviewIn, const COutPoint* poutpointsIn, Coin* pcoinsIn, size_t nCountIn) :
+        pview(pviewIn), poutpoints(poutpointsIn), pcoins(pcoinsIn), nCount(nCountIn) { }
+
+    bool operator()();
+
+    void swap(CCoinPrefetchCheck &check) {
+        std::swap(pview, check.pview);
+        std::swap(poutpoints, check.poutpoints);
+        std::swap(pcoins, check.pcoins);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/**
+ * Deserialize a transaction vector from s. The transaction boundaries are
+ * found by a scan over the raw bytes first; the transactions themselves are
+ * then decoded and hashed on the transaction decoding threads.
+ * Produces the same result as s >> vtx, and throws std::ios_base::failure
+ * on malformed data.
+ */
+void DeserializeTransactionsParallel(CDataStream& s, std::vector<CTransactionRef>& vtx);
+/** Deserialize a block from s, decoding its transactions in parallel. */
+void DeserializeBlockParallel(CDataStream& s, CBlock& block);
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
@@ -396,6 +540,8 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block like ReadBlockFromDisk, through the block cache. Returns null on failure. */
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -483,4 +629,20 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/**
+ * Write the UTXO set at TXOUTSET_SNAPSHOT_DEPTH blocks below the current tip to a
+ * snapshot file, filling in the statistics of what was written.
+ */
+bool DumpTxOutSet(const fs::path& path, CCoinsStats& stats, std::string& strError);
+
+/**
+ * Load a UTXO set snapshot into an empty chainstate and make its base block the tip.
+ * The snapshot must be of block hashBlockExpected and have hashSerializedExpected
+ * as its hash_serialized_2, which have to come from a trusted source.
+ */
+bool LoadTxOutSet(const CChainParams& chainparams, const fs::path& path, const uint256& hashBlockExpected, const uint256& hashSerializedExpected, std::string& strError);
+
+/** Whether blocks of the active chain were taken from a UTXO snapshot and have no data to serve */
+bool HaveAssumedValidBlocksWithoutData();
+
 #endif // herbsters_VALIDATION_H
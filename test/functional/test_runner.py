@@ -147,6 +147,7 @@ EXTENDED_SCRIPTS = [
     # vv Tests less than 30s vv
     'assumevalid.py',
     'example_test.py',
+    'utxo_snapshot.py',
     'txn_doublespend.py',
     'txn_clone.py --mineblock',
     'forknotify.py',
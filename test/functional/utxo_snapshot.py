@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and starting a node from the snapshot with -loadtxoutset.
+
+- node0 mines a chain with some spends and dumps its UTXO set.
+- node1 refuses a corrupted snapshot and one that does not match the
+  expected hashes, then starts from the real one and
+  reports the same tip and UTXO set hash as node0. It does not advertise
+  NODE_NETWORK and answers requests for blocks below the base with notfound.
+- node1 syncs blocks mined on top of the snapshot, and restarts cleanly.
+"""
+import os
+
+from test_framework.mininode import *
+from test_framework.test_framework import herbstersTestFramework
+from test_framework.util import *
+
+class UTXOSnapshotTest(herbstersTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [[], ["-checkblockindex=1"]]
+
+    def setup_network(self):
+        # node1 must not sync from node0 before it has loaded the snapshot.
+        self.setup_nodes()
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(150)
+        for i in range(5):
+            node0.sendtoaddress(node0.getnewaddress(), 1)
+        node0.generate(1)
+
+        self.log.info("Dump the UTXO set")
+        result = node0.dumptxoutset('utxo.dat')
+        snapshot_path = os.path.join(node0.datadir, 'regtest', 'utxo.dat')
+        assert_equal(result['path'], snapshot_path)
+        # The snapshot is taken 10 blocks below the tip.
+        assert_equal(result['base_height'], 141)
+        assert_equal(result['base_hash'], node0.getblockhash(141))
+        hash_above_base = node0.getblockhash(142)
+        node0.invalidateblock(hash_above_base)
+        info = node0.gettxoutsetinfo()
+        node0.reconsiderblock(hash_above_base)
+        assert_equal(result['coins_written'], info['txouts'])
+        assert_equal(result['hash_serialized_2'], info['hash_serialized_2'])
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, 'utxo.dat')
+
+        self.log.info("Refuse a corrupted snapshot")
+        with open(snapshot_path, 'rb') as f:
+            data = bytearray(f.read())
+        data[-100] ^= 1
+        bad_path = os.path.join(self.options.tmpdir, 'bad.dat')
+        with open(bad_path, 'wb') as f:
+            f.write(data)
+        self.stop_node(1)
+        snapshot_hash = "-loadtxoutsethash=%s:%s" % (result['base_hash'], result['hash_serialized_2'])
+        self.assert_start_raises_init_error(1, ["-loadtxoutset=" + bad_path, snapshot_hash], "Unable to load UTXO snapshot")
+        self.assert_start_raises_init_error(1, ["-loadtxoutset=" + snapshot_path], "requires -loadtxoutsethash")
+        wrong_hash = "-loadtxoutsethash=%s:%s" % (result['base_hash'], "00" * 32)
+        self.assert_start_raises_init_error(1, ["-loadtxoutset=" + snapshot_path, wrong_hash], "does not match the expected")
+
+        self.log.info("Start a node from the snapshot")
+        self.start_node(1, ["-checkblockindex=1", "-loadtxoutset=" + snapshot_path, snapshot_hash])
+        node1 = self.nodes[1]
+        assert_equal(node1.getbestblockhash(), result['base_hash'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], result['hash_serialized_2'])
+        assert_raises_rpc_error(-1, "Block not found on disk", node1.getblock, node0.getblockhash(100))
+        assert_equal(int(node1.getnetworkinfo()['localservices'], 16) & NODE_NETWORK, 0)
+
+        self.log.info("Answer requests for blocks below the base with notfound")
+        test_node = NodeConnCB()
+        test_node.add_connection(NodeConn('127.0.0.1', p2p_port(1), node1, test_node))
+        NetworkThread().start()
+        test_node.wait_for_verack()
+        test_node.send_message(msg_getdata([CInv(2, int(node0.getblockhash(100), 16))]))
+        wait_until(lambda: "notfound" in test_node.last_message, lock=mininode_lock)
+        assert_equal(test_node.last_message["notfound"].inv[0].hash, int(node0.getblockhash(100), 16))
+        test_node.connection.disconnect_node()
+        test_node.wait_for_disconnect()
+
+        self.log.info("Sync blocks on top of the snapshot")
+        connect_nodes_bi(self.nodes, 0, 1)
+        node0.generate(10)
+        sync_blocks(self.nodes)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("Restart the node; the snapshot option is ignored now")
+        self.stop_node(1)
+        self.start_node(1, ["-checkblockindex=1", "-loadtxoutset=" + snapshot_path, snapshot_hash])
+        assert_equal(self.nodes[1].getbestblockhash(), node0.getbestblockhash())
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()